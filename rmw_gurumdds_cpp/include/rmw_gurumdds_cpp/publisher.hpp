@@ -0,0 +1,65 @@
+// Copyright 2019 GurumNetworks, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RMW_GURUMDDS_CPP__PUBLISHER_HPP_
+#define RMW_GURUMDDS_CPP__PUBLISHER_HPP_
+
+#include <cstddef>
+
+#include "rmw/rmw.h"
+#include "rmw_gurumdds_cpp/visibility_control.h"
+
+namespace rmw_gurumdds_cpp
+{
+
+// Returned by rmw_publish() and rmw_publish_serialized_message() when a
+// non-blocking publisher can't accept a sample without waiting for its
+// reliable writer history to drain. The sample is not published.
+// RMW_RET_TIMEOUT is only seen by direct rmw callers: rcl turns it into
+// RCL_RET_ERROR, so rcl and rclcpp users should detect backpressure with
+// set_publisher_backpressure_callback() instead.
+constexpr rmw_ret_t RET_WOULD_BLOCK = RMW_RET_TIMEOUT;
+
+// Passed through rmw_publisher_options_t::rmw_specific_publisher_payload
+struct PublisherPayload
+{
+  // Fail with RET_WOULD_BLOCK instead of blocking up to max_blocking_time
+  bool non_blocking;
+};
+
+// Called when publishing starts to fail because the writer history is full
+// (blocked == true), and when it succeeds again (blocked == false)
+typedef void (* PublisherBackpressureCallback)(
+  const rmw_publisher_t * publisher, bool blocked, void * user_data);
+
+RMW_GURUMDDS_CPP_PUBLIC
+rmw_ret_t
+set_publisher_backpressure_callback(
+  rmw_publisher_t * publisher,
+  PublisherBackpressureCallback callback,
+  void * user_data);
+
+// Number of samples written by the publisher that are not known to be
+// acknowledged by all matched subscriptions yet. This is an upper bound:
+// it only drops when every sample written so far has been acknowledged, and
+// is capped at what the writer can hold unacknowledged (the history depth for
+// KEEP_LAST, max_samples for KEEP_ALL, 0 for best effort). A publisher that
+// never pauses may stay at the cap, so throttle on reaching it.
+RMW_GURUMDDS_CPP_PUBLIC
+rmw_ret_t
+get_publisher_unacked_count(const rmw_publisher_t * publisher, size_t * count);
+
+}  // namespace rmw_gurumdds_cpp
+
+#endif  // RMW_GURUMDDS_CPP__PUBLISHER_HPP_
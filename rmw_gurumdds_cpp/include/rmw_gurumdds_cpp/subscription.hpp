@@ -0,0 +1,121 @@
+// Copyright 2019 GurumNetworks, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RMW_GURUMDDS_CPP__SUBSCRIPTION_HPP_
+#define RMW_GURUMDDS_CPP__SUBSCRIPTION_HPP_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "rcutils/allocator.h"
+
+#include "rmw/rmw.h"
+#include "rmw_gurumdds_cpp/visibility_control.h"
+
+namespace rmw_gurumdds_cpp
+{
+
+// Message dropped when a new message would exceed the queue byte budget
+enum class QueueBudgetPolicy : uint8_t
+{
+  DROP_OLDEST,
+  DROP_NEWEST
+};
+
+// Passed through rmw_subscription_options_t::rmw_specific_subscription_payload
+struct SubscriptionPayload
+{
+  // Leave samples in the DataReader and take them when the subscription is
+  // taken from, instead of queueing them on the listener thread.
+  // Setting RMW_GURUMDDS_DIRECT_TAKE=1 makes this the default.
+  bool direct_take;
+  // Samples taken from the reader by one listener callback, 0 keeps the default.
+  // Raising it lets bursty topics be drained in fewer callbacks. Values above
+  // 4096 fail the subscription creation.
+  // RMW_GURUMDDS_MAX_SAMPLES_PER_CALLBACK sets the default for all subscriptions.
+  uint32_t max_samples_per_callback;
+  // Keep only the newest message of each publisher until it is taken. Older
+  // messages are dropped without being deserialized and reported as lost
+  // samples. Overrides direct_take, since messages are conflated on arrival.
+  bool conflate;
+  // Deserialize up to this many queued messages on the listener thread as they
+  // arrive, so takes only hand over a ready message. Only applies to C messages
+  // and to subscriptions with loan_messages set, since other takes can't use
+  // them, and starts with the first take that is not serialized. Messages
+  // arriving while this many are waiting are deserialized when taken.
+  // 0 disables it.
+  // RMW_GURUMDDS_PRE_DESERIALIZE_DEPTH sets the default for all subscriptions.
+  uint32_t pre_deserialize_depth;
+  // Bytes of serialized messages the message queue may hold, 0 for no limit.
+  // A message larger than the budget is only queued into an empty queue.
+  // RMW_GURUMDDS_QUEUE_BYTE_BUDGET sets the default for all subscriptions.
+  // Not applied in direct-take and conflation modes, which don't queue messages.
+  size_t queue_byte_budget;
+  QueueBudgetPolicy queue_budget_policy;
+  // Like the DDS TIME_BASED_FILTER: samples received less than this many
+  // nanoseconds after the last accepted one of the same publication are freed
+  // without being deserialized. 0 disables it.
+  uint64_t minimum_separation;
+  // Set can_loan_messages, so that rclcpp takes loaned messages from a pool of
+  // initialized messages owned by the subscription instead of allocating them.
+  // Setting RMW_GURUMDDS_LOAN_MESSAGES=1 makes this the default.
+  bool loan_messages;
+};
+
+struct SubscriptionQueueStatistics
+{
+  // Bytes of serialized messages in the message queue, and the most it held
+  size_t queued_bytes;
+  size_t peak_queued_bytes;
+  // Messages dropped to keep the queue within its byte budget
+  uint64_t budget_dropped_count;
+  uint64_t budget_dropped_bytes;
+};
+
+// Allocator for serialized messages that take over the received sample
+// buffer in rmw_take_serialized_message() instead of copying it. The previous
+// buffer is released on each take, and on rmw_serialized_message_fini().
+// It cannot allocate: initialize the message with zero capacity and don't
+// resize it. Messages with any other allocator get a copy of the sample.
+RMW_GURUMDDS_CPP_PUBLIC
+rcutils_allocator_t
+get_sample_buffer_allocator();
+
+// Takes up to count serialized messages in one call, so recorders and bridges
+// can drain bursts without a call per sample. serialized_messages must hold
+// count initialized messages, and message_infos count infos unless it is null.
+// The number of messages filled from the front is returned in taken.
+RMW_GURUMDDS_CPP_PUBLIC
+rmw_ret_t
+take_serialized_sequence(
+  const rmw_subscription_t * subscription,
+  size_t count,
+  rmw_serialized_message_t * serialized_messages,
+  rmw_message_info_t * message_infos,
+  size_t * taken);
+
+RMW_GURUMDDS_CPP_PUBLIC
+rmw_ret_t
+get_subscription_queue_statistics(
+  const rmw_subscription_t * subscription,
+  SubscriptionQueueStatistics * statistics);
+
+// Number of samples suppressed by SubscriptionPayload::minimum_separation
+RMW_GURUMDDS_CPP_PUBLIC
+rmw_ret_t
+get_subscription_time_filtered_count(const rmw_subscription_t * subscription, uint64_t * count);
+
+}  // namespace rmw_gurumdds_cpp
+
+#endif  // RMW_GURUMDDS_CPP__SUBSCRIPTION_HPP_
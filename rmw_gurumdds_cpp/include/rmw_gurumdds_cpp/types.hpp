@@ -15,10 +15,16 @@
 #ifndef RMW_GURUMDDS_CPP__TYPES_HPP_
 #define RMW_GURUMDDS_CPP__TYPES_HPP_
 
-#include <queue>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
 
 #include "rmw/rmw.h"
 #include "rmw_gurumdds_shared_cpp/types.hpp"
+#include "rmw_gurumdds_cpp/publisher.hpp"
+
+class ContentFilter;
+class MessagePool;
 
 typedef struct _GurumddsPublisherInfo : GurumddsEventInfo
 {
@@ -29,9 +35,23 @@ typedef struct _GurumddsPublisherInfo : GurumddsEventInfo
   const rosidl_message_type_support_t * rosidl_message_typesupport;
   const char * implementation_identifier;
 
+  bool non_blocking;
+  std::atomic<bool> blocked;
+  std::mutex backpressure_mutex;
+  rmw_gurumdds_cpp::PublisherBackpressureCallback backpressure_callback;
+  void * backpressure_user_data;
+
+  // Samples written, and how many of them are known to be acknowledged
+  std::atomic<uint64_t> written_count;
+  std::atomic<uint64_t> acked_count;
+  // Most samples the writer holds unacknowledged, 0 for best-effort writers
+  size_t unacked_limit;
+
   rmw_ret_t get_status(dds_StatusMask mask, void * event) override;
   dds_StatusCondition * get_statuscondition() override;
   dds_StatusMask get_status_changes() override;
+  rmw_ret_t set_event_callback(
+    rmw_event_type_t event_type, rmw_event_callback_t callback, const void * user_data) override;
 } GurumddsPublisherInfo;
 
 typedef struct _GurumddsPublisherGID
@@ -43,25 +63,101 @@ typedef struct _GurumddsSubscriberInfo : GurumddsEventInfo
 {
   dds_Subscriber * subscriber;
   dds_DataReader * topic_reader;
-  std::queue<GurumddsMessage> message_queue;
+  dds_Topic * topic;
+  dds_ContentFilteredTopic * content_filtered_topic;
+  // Filter set by the user, and the one evaluated on raw samples when DDS does not filter.
+  // Both are replaced at runtime, so they are accessed with std::atomic_load/store.
+  std::shared_ptr<ContentFilter> content_filter;
+  std::shared_ptr<ContentFilter> reader_content_filter;
+  GurumddsMessageQueue message_queue;
   dds_GuardCondition * queue_guard_condition;
-  std::mutex queue_mutex;
+  GurumddsReaderSeqs reader_seqs;
+  // Not invoked in direct-take mode, where messages are not taken by the listener
+  GurumddsEventCallback new_message_callback;
+  // Set in direct-take mode, where samples are taken from the reader instead of the queue
+  dds_ReadCondition * read_condition;
+  // Messages dropped from the full message queue, and how many of them were reported
+  std::atomic<uint64_t> queue_lost_count;
+  std::atomic<uint64_t> queue_lost_reported;
+  // Bytes of the messages in message_queue, kept within queue_byte_budget unless it is 0
+  size_t queue_byte_budget;
+  bool queue_drop_newest;
+  std::atomic<size_t> queued_bytes;
+  std::atomic<size_t> peak_queued_bytes;
+  std::atomic<uint64_t> budget_dropped_count;
+  std::atomic<uint64_t> budget_dropped_bytes;
   dds_TypeSupport * dds_typesupport;
   const rosidl_message_type_support_t * rosidl_message_typesupport;
   const char * implementation_identifier;
+  // Messages loaned by rmw_take_loaned_message()
+  std::shared_ptr<MessagePool> message_pool;
+  // Set by the first take that deserializes, messages are only prepared after it
+  std::atomic<bool> deserializing_takes;
+  // Samples written by this participant are dropped before they are queued
+  bool ignore_local_publications;
+  uint8_t participant_guid_prefix[12];
+  // Set in conflation mode, where only the newest message of each publication is kept
+  bool conflate;
+  std::mutex conflation_mutex;
+  std::unordered_map<dds_InstanceHandle_t, GurumddsMessage> latest_messages;
+  // Samples closer than this to the last accepted one of their publication are
+  // dropped before they are queued
+  rcutils_duration_value_t minimum_separation;
+  std::mutex time_filter_mutex;
+  std::unordered_map<dds_InstanceHandle_t, rcutils_time_point_value_t> last_accepted_timestamps;
+  std::atomic<uint64_t> time_filtered_count;
+  // Publisher GIDs of matched publications, keyed by publication handle
+  std::mutex gid_cache_mutex;
+  std::unordered_map<dds_InstanceHandle_t, GurumddsPublisherGID> gid_cache;
 
   rmw_ret_t get_status(dds_StatusMask mask, void * event) override;
   dds_StatusCondition * get_statuscondition() override;
   dds_StatusMask get_status_changes() override;
+  rmw_ret_t set_event_callback(
+    rmw_event_type_t event_type, rmw_event_callback_t callback, const void * user_data) override;
+
+  // Statuses handled by the DataReader listener
+  dds_StatusMask get_listener_mask();
 } GurumddsSubscriberInfo;
 
+// Every callback is set; the listener mask decides which ones DDS invokes
+dds_DataReaderListener get_datareader_listener();
+
+bool reader_accept_sample(GurumddsSubscriberInfo * subscriber_info, const GurumddsMessage & msg);
+
+void reader_on_messages_dropped(GurumddsSubscriberInfo * subscriber_info, size_t count);
+
+bool reader_queue_message(
+  GurumddsSubscriberInfo * subscriber_info, const GurumddsMessage & msg, size_t * dropped);
+
+// Takes the oldest message of the message queue
+bool queued_message_pop(GurumddsSubscriberInfo * subscriber_info, GurumddsMessage * msg);
+
+// Takes the oldest of the messages kept in conflation mode
+bool conflated_message_pop(GurumddsSubscriberInfo * subscriber_info, GurumddsMessage * msg);
+
+void conflated_message_clear(GurumddsSubscriberInfo * subscriber_info);
+
+void reader_on_subscription_matched(
+  const dds_DataReader * reader, const dds_SubscriptionMatchedStatus * status);
+
+// Falls back to the DataReader if the publication is not cached
+void get_publisher_gid(
+  GurumddsSubscriberInfo * subscriber_info,
+  dds_InstanceHandle_t publication_handle,
+  GurumddsPublisherGID * publisher_gid);
+
+// Caches the publications matched before the listener context was set
+void seed_publisher_gid_cache(GurumddsSubscriberInfo * subscriber_info);
+
 typedef struct _GurumddsServiceInfo
 {
   const rosidl_service_type_support_t * service_typesupport;
 
-  std::queue<GurumddsMessage> message_queue;
+  GurumddsMessageQueue message_queue;
   dds_GuardCondition * queue_guard_condition;
-  std::mutex queue_mutex;
+  GurumddsReaderSeqs reader_seqs;
+  GurumddsEventCallback new_message_callback;
 
   dds_Subscriber * dds_subscriber;
   dds_DataReader * request_reader;
@@ -77,9 +173,10 @@ typedef struct _GurumddsClientInfo
 {
   const rosidl_service_type_support_t * service_typesupport;
 
-  std::queue<GurumddsMessage> message_queue;
+  GurumddsMessageQueue message_queue;
   dds_GuardCondition * queue_guard_condition;
-  std::mutex queue_mutex;
+  GurumddsReaderSeqs reader_seqs;
+  GurumddsEventCallback new_message_callback;
 
   dds_Publisher * dds_publisher;
   dds_DataWriter * request_writer;
@@ -0,0 +1,937 @@
+// Copyright 2019 GurumNetworks, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "rmw/error_handling.h"
+
+#include "rosidl_typesupport_introspection_c/identifier.h"
+#include "rosidl_typesupport_introspection_c/message_introspection.h"
+
+#include "rosidl_typesupport_introspection_cpp/field_types.hpp"
+#include "rosidl_typesupport_introspection_cpp/identifier.hpp"
+#include "rosidl_typesupport_introspection_cpp/message_introspection.hpp"
+
+#include "./cdr_buffer.hpp"
+#include "./content_filter.hpp"
+
+using rosidl_typesupport_introspection_cpp::ROS_TYPE_BOOLEAN;
+using rosidl_typesupport_introspection_cpp::ROS_TYPE_CHAR;
+using rosidl_typesupport_introspection_cpp::ROS_TYPE_OCTET;
+using rosidl_typesupport_introspection_cpp::ROS_TYPE_UINT8;
+using rosidl_typesupport_introspection_cpp::ROS_TYPE_INT8;
+using rosidl_typesupport_introspection_cpp::ROS_TYPE_UINT16;
+using rosidl_typesupport_introspection_cpp::ROS_TYPE_INT16;
+using rosidl_typesupport_introspection_cpp::ROS_TYPE_FLOAT;
+using rosidl_typesupport_introspection_cpp::ROS_TYPE_UINT32;
+using rosidl_typesupport_introspection_cpp::ROS_TYPE_INT32;
+using rosidl_typesupport_introspection_cpp::ROS_TYPE_WCHAR;
+using rosidl_typesupport_introspection_cpp::ROS_TYPE_DOUBLE;
+using rosidl_typesupport_introspection_cpp::ROS_TYPE_LONG_DOUBLE;
+using rosidl_typesupport_introspection_cpp::ROS_TYPE_UINT64;
+using rosidl_typesupport_introspection_cpp::ROS_TYPE_INT64;
+using rosidl_typesupport_introspection_cpp::ROS_TYPE_STRING;
+using rosidl_typesupport_introspection_cpp::ROS_TYPE_WSTRING;
+using rosidl_typesupport_introspection_cpp::ROS_TYPE_MESSAGE;
+
+struct ContentFilter::Layout
+{
+  struct Member
+  {
+    std::string name;
+    uint8_t type_id;
+    bool is_array;
+    bool is_sequence;
+    size_t array_size;
+    std::unique_ptr<Layout> nested;
+  };
+
+  std::vector<Member> members;
+};
+
+struct ContentFilter::Field
+{
+  struct Step
+  {
+    size_t member;
+    bool indexed;
+    uint32_t index;
+  };
+
+  std::vector<Step> steps;
+};
+
+struct ContentFilter::Value
+{
+  enum Kind {NONE, SIGNED, UNSIGNED, FLOAT, STRING};
+
+  Kind kind = NONE;
+  int64_t i = 0;
+  uint64_t u = 0;
+  double f = 0.0;
+  std::string s;
+};
+
+struct ContentFilter::Node
+{
+  enum Kind {AND, OR, NOT, COMPARE, BETWEEN, LIKE};
+  enum Op {EQ, NE, LT, LE, GT, GE};
+
+  struct Operand
+  {
+    bool is_field = false;
+    Field field;
+    Value value;
+  };
+
+  Kind kind;
+  Op op = EQ;
+  bool negate = false;
+  std::unique_ptr<Node> lhs;
+  std::unique_ptr<Node> rhs;
+  Operand operands[3];
+};
+
+namespace
+{
+typedef ContentFilter::Layout Layout;
+typedef ContentFilter::Field Field;
+typedef ContentFilter::Value Value;
+typedef ContentFilter::Node Node;
+
+template<typename MessageMembersT>
+std::unique_ptr<Layout> build_layout(const MessageMembersT * members)
+{
+  std::unique_ptr<Layout> layout(new Layout());
+  layout->members.resize(members->member_count_);
+  for (uint32_t i = 0; i < members->member_count_; i++) {
+    auto member = members->members_ + i;
+    Layout::Member & dst = layout->members[i];
+    dst.name = member->name_;
+    dst.type_id = member->type_id_;
+    dst.is_array = member->is_array_;
+    dst.is_sequence = member->is_array_ && (!member->array_size_ || member->is_upper_bound_);
+    dst.array_size = member->array_size_;
+    if (member->type_id_ == ROS_TYPE_MESSAGE) {
+      dst.nested = build_layout(static_cast<const MessageMembersT *>(member->members_->data));
+    }
+  }
+  return layout;
+}
+
+size_t primitive_size(uint8_t type_id)
+{
+  switch (type_id) {
+    case ROS_TYPE_BOOLEAN:
+    case ROS_TYPE_CHAR:
+    case ROS_TYPE_OCTET:
+    case ROS_TYPE_UINT8:
+    case ROS_TYPE_INT8:
+      return 1;
+    case ROS_TYPE_UINT16:
+    case ROS_TYPE_INT16:
+      return 2;
+    case ROS_TYPE_FLOAT:
+    case ROS_TYPE_UINT32:
+    case ROS_TYPE_INT32:
+    case ROS_TYPE_WCHAR:
+      return 4;
+    case ROS_TYPE_DOUBLE:
+    case ROS_TYPE_LONG_DOUBLE:
+    case ROS_TYPE_UINT64:
+    case ROS_TYPE_INT64:
+      return 8;
+    default:
+      return 0;
+  }
+}
+
+// ================================================================================================
+// Raw CDR access
+
+class CDRFieldReader : public CDRDeserializationBuffer
+{
+public:
+  CDRFieldReader(uint8_t * a_buf, size_t a_size)
+  : CDRDeserializationBuffer(a_buf, a_size) {}
+
+  void skip(size_t align_, size_t cnt)
+  {
+    align(align_);
+    if (offset + cnt > size) {
+      throw std::runtime_error("Out of buffer");
+    }
+    advance(cnt);
+  }
+
+  void skip_elements(const Layout::Member & member, size_t count)
+  {
+    if (count == 0) {
+      return;
+    }
+
+    size_t primitive = primitive_size(member.type_id);
+    if (primitive != 0) {
+      skip(primitive, primitive * count);
+      return;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+      uint32_t str_size = 0;
+      switch (member.type_id) {
+        case ROS_TYPE_STRING:
+          *this >> str_size;
+          skip(1, str_size);
+          break;
+        case ROS_TYPE_WSTRING:
+          *this >> str_size;
+          skip(4, static_cast<size_t>(str_size) * 4);
+          break;
+        case ROS_TYPE_MESSAGE:
+          for (auto & nested : member.nested->members) {
+            skip_member(nested);
+          }
+          break;
+        default:
+          throw std::runtime_error("Unknown member type");
+      }
+    }
+  }
+
+  void skip_member(const Layout::Member & member)
+  {
+    skip_elements(member, element_count(member));
+  }
+
+  size_t element_count(const Layout::Member & member)
+  {
+    if (!member.is_array) {
+      return 1;
+    }
+    if (!member.is_sequence) {
+      return member.array_size;
+    }
+    uint32_t count = 0;
+    *this >> count;
+    return count;
+  }
+
+  void read_value(uint8_t type_id, Value & value)
+  {
+    uint8_t u8 = 0;
+    uint16_t u16 = 0;
+    uint32_t u32 = 0;
+    uint64_t u64 = 0;
+    float f32 = 0.0f;
+    double f64 = 0.0;
+    std::u16string wstr;
+
+    switch (type_id) {
+      case ROS_TYPE_BOOLEAN:
+      case ROS_TYPE_CHAR:
+      case ROS_TYPE_OCTET:
+      case ROS_TYPE_UINT8:
+        *this >> u8;
+        value.kind = Value::UNSIGNED;
+        value.u = u8;
+        break;
+      case ROS_TYPE_INT8:
+        *this >> u8;
+        value.kind = Value::SIGNED;
+        value.i = static_cast<int8_t>(u8);
+        break;
+      case ROS_TYPE_UINT16:
+        *this >> u16;
+        value.kind = Value::UNSIGNED;
+        value.u = u16;
+        break;
+      case ROS_TYPE_INT16:
+        *this >> u16;
+        value.kind = Value::SIGNED;
+        value.i = static_cast<int16_t>(u16);
+        break;
+      case ROS_TYPE_UINT32:
+      case ROS_TYPE_WCHAR:
+        *this >> u32;
+        value.kind = Value::UNSIGNED;
+        value.u = u32;
+        break;
+      case ROS_TYPE_INT32:
+        *this >> u32;
+        value.kind = Value::SIGNED;
+        value.i = static_cast<int32_t>(u32);
+        break;
+      case ROS_TYPE_UINT64:
+        *this >> u64;
+        value.kind = Value::UNSIGNED;
+        value.u = u64;
+        break;
+      case ROS_TYPE_INT64:
+        *this >> u64;
+        value.kind = Value::SIGNED;
+        value.i = static_cast<int64_t>(u64);
+        break;
+      case ROS_TYPE_FLOAT:
+        *this >> u32;
+        memcpy(&f32, &u32, sizeof(f32));
+        value.kind = Value::FLOAT;
+        value.f = f32;
+        break;
+      case ROS_TYPE_DOUBLE:
+      case ROS_TYPE_LONG_DOUBLE:
+        *this >> u64;
+        memcpy(&f64, &u64, sizeof(f64));
+        value.kind = Value::FLOAT;
+        value.f = f64;
+        break;
+      case ROS_TYPE_STRING:
+        *this >> value.s;
+        value.kind = Value::STRING;
+        break;
+      case ROS_TYPE_WSTRING:
+        *this >> wstr;
+        value.s.clear();
+        for (auto c : wstr) {
+          value.s.push_back(c < 0x80 ? static_cast<char>(c) : '?');
+        }
+        value.kind = Value::STRING;
+        break;
+      default:
+        throw std::runtime_error("Unknown member type");
+    }
+  }
+};
+
+// Returns false if the field is not present in the sample (index out of range)
+bool read_field(const Layout & root, const Field & field, CDRFieldReader & reader, Value & value)
+{
+  const Layout * layout = &root;
+  for (size_t i = 0; i < field.steps.size(); i++) {
+    auto & step = field.steps[i];
+    for (size_t j = 0; j < step.member; j++) {
+      reader.skip_member(layout->members[j]);
+    }
+
+    auto & member = layout->members[step.member];
+    if (member.is_array) {
+      size_t count = reader.element_count(member);
+      if (step.index >= count) {
+        return false;
+      }
+      reader.skip_elements(member, step.index);
+    }
+
+    if (i + 1 == field.steps.size()) {
+      reader.read_value(member.type_id, value);
+    } else {
+      layout = member.nested.get();
+    }
+  }
+  return true;
+}
+
+// ================================================================================================
+// Expression parser
+
+struct Token
+{
+  enum Kind {END, IDENT, NUMBER, STRING, PARAM, OP, LPAREN, RPAREN};
+
+  Kind kind;
+  std::string text;
+};
+
+bool is_ident_char(char c)
+{
+  return isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '.' || c == '[' || c == ']';
+}
+
+std::vector<Token> tokenize(const std::string & expression)
+{
+  std::vector<Token> tokens;
+  size_t pos = 0;
+  while (pos < expression.size()) {
+    char c = expression[pos];
+    if (isspace(static_cast<unsigned char>(c))) {
+      pos++;
+      continue;
+    }
+
+    size_t start = pos;
+    if (c == '(') {
+      tokens.push_back({Token::LPAREN, "("});
+      pos++;
+    } else if (c == ')') {
+      tokens.push_back({Token::RPAREN, ")"});
+      pos++;
+    } else if (c == '\'' || c == '`') {
+      char quote = c == '`' ? '\'' : c;
+      pos++;
+      while (pos < expression.size() && expression[pos] != quote) {
+        pos++;
+      }
+      if (pos >= expression.size()) {
+        throw std::runtime_error("unterminated string literal");
+      }
+      tokens.push_back({Token::STRING, expression.substr(start + 1, pos - start - 1)});
+      pos++;
+    } else if (c == '%') {
+      pos++;
+      while (pos < expression.size() && isdigit(static_cast<unsigned char>(expression[pos]))) {
+        pos++;
+      }
+      if (pos == start + 1) {
+        throw std::runtime_error("parameter index expected after '%'");
+      }
+      tokens.push_back({Token::PARAM, expression.substr(start + 1, pos - start - 1)});
+    } else if (isdigit(static_cast<unsigned char>(c)) ||
+      ((c == '-' || c == '+' || c == '.') && pos + 1 < expression.size() &&
+      isdigit(static_cast<unsigned char>(expression[pos + 1]))))
+    {
+      pos++;
+      while (pos < expression.size() &&
+        (isalnum(static_cast<unsigned char>(expression[pos])) || expression[pos] == '.' ||
+        ((expression[pos] == '-' || expression[pos] == '+') &&
+        (expression[pos - 1] == 'e' || expression[pos - 1] == 'E'))))
+      {
+        pos++;
+      }
+      tokens.push_back({Token::NUMBER, expression.substr(start, pos - start)});
+    } else if (isalpha(static_cast<unsigned char>(c)) || c == '_') {
+      while (pos < expression.size() && is_ident_char(expression[pos])) {
+        pos++;
+      }
+      tokens.push_back({Token::IDENT, expression.substr(start, pos - start)});
+    } else if (c == '<' || c == '>' || c == '!' || c == '=') {
+      pos++;
+      if (pos < expression.size() &&
+        (expression[pos] == '=' || (c == '<' && expression[pos] == '>')))
+      {
+        pos++;
+      }
+      std::string op = expression.substr(start, pos - start);
+      if (op == "!") {
+        throw std::runtime_error("unexpected character '!'");
+      }
+      tokens.push_back({Token::OP, op == "==" ? "=" : op});
+    } else {
+      throw std::runtime_error(std::string("unexpected character '") + c + "'");
+    }
+  }
+  tokens.push_back({Token::END, ""});
+  return tokens;
+}
+
+bool is_keyword(const Token & token, const char * keyword)
+{
+  if (token.kind != Token::IDENT || token.text.size() != strlen(keyword)) {
+    return false;
+  }
+  for (size_t i = 0; i < token.text.size(); i++) {
+    if (toupper(static_cast<unsigned char>(token.text[i])) != keyword[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+Value parse_number(const std::string & text)
+{
+  Value value;
+  char * end = nullptr;
+  bool is_float = text.find_first_of(".eE") != std::string::npos &&
+    text.find_first_of("xX") == std::string::npos;
+  errno = 0;
+  if (is_float) {
+    value.kind = Value::FLOAT;
+    value.f = strtod(text.c_str(), &end);
+  } else if (text[0] == '-') {
+    value.kind = Value::SIGNED;
+    value.i = strtoll(text.c_str(), &end, 0);
+  } else {
+    value.kind = Value::UNSIGNED;
+    value.u = strtoull(text.c_str(), &end, 0);
+  }
+  if (end == nullptr || *end != '\0' || errno == ERANGE) {
+    throw std::runtime_error("invalid number '" + text + "'");
+  }
+  return value;
+}
+
+Value parse_parameter(const std::string & text)
+{
+  std::vector<Token> tokens;
+  try {
+    tokens = tokenize(text);
+  } catch (const std::runtime_error &) {
+    tokens.clear();
+  }
+
+  if (tokens.size() == 2) {
+    if (tokens[0].kind == Token::NUMBER) {
+      return parse_number(tokens[0].text);
+    }
+    if (tokens[0].kind == Token::STRING) {
+      Value value;
+      value.kind = Value::STRING;
+      value.s = tokens[0].text;
+      return value;
+    }
+    if (is_keyword(tokens[0], "TRUE") || is_keyword(tokens[0], "FALSE")) {
+      Value value;
+      value.kind = Value::UNSIGNED;
+      value.u = is_keyword(tokens[0], "TRUE") ? 1 : 0;
+      return value;
+    }
+  }
+
+  // Unquoted parameters are taken verbatim as strings
+  Value value;
+  value.kind = Value::STRING;
+  value.s = text;
+  return value;
+}
+
+class Parser
+{
+public:
+  Parser(
+    const Layout & a_layout, const std::string & expression,
+    const std::vector<std::string> & a_parameters)
+  : layout(a_layout), parameters(a_parameters), tokens(tokenize(expression)), pos(0) {}
+
+  std::unique_ptr<Node> parse()
+  {
+    auto node = parse_or();
+    if (tokens[pos].kind != Token::END) {
+      throw std::runtime_error("unexpected token '" + tokens[pos].text + "'");
+    }
+    return node;
+  }
+
+private:
+  std::unique_ptr<Node> make_logical(
+    Node::Kind kind, std::unique_ptr<Node> lhs, std::unique_ptr<Node> rhs)
+  {
+    std::unique_ptr<Node> node(new Node());
+    node->kind = kind;
+    node->lhs = std::move(lhs);
+    node->rhs = std::move(rhs);
+    return node;
+  }
+
+  std::unique_ptr<Node> parse_or()
+  {
+    auto node = parse_and();
+    while (is_keyword(tokens[pos], "OR")) {
+      pos++;
+      node = make_logical(Node::OR, std::move(node), parse_and());
+    }
+    return node;
+  }
+
+  std::unique_ptr<Node> parse_and()
+  {
+    auto node = parse_not();
+    while (is_keyword(tokens[pos], "AND")) {
+      pos++;
+      node = make_logical(Node::AND, std::move(node), parse_not());
+    }
+    return node;
+  }
+
+  std::unique_ptr<Node> parse_not()
+  {
+    if (is_keyword(tokens[pos], "NOT")) {
+      pos++;
+      return make_logical(Node::NOT, parse_not(), nullptr);
+    }
+    if (tokens[pos].kind == Token::LPAREN) {
+      pos++;
+      auto node = parse_or();
+      if (tokens[pos].kind != Token::RPAREN) {
+        throw std::runtime_error("')' expected");
+      }
+      pos++;
+      return node;
+    }
+    return parse_predicate();
+  }
+
+  std::unique_ptr<Node> parse_predicate()
+  {
+    std::unique_ptr<Node> node(new Node());
+    parse_operand(node->operands[0]);
+
+    if (is_keyword(tokens[pos], "NOT")) {
+      node->negate = true;
+      pos++;
+      if (!is_keyword(tokens[pos], "BETWEEN") && !is_keyword(tokens[pos], "LIKE")) {
+        throw std::runtime_error("BETWEEN or LIKE expected after NOT");
+      }
+    }
+
+    if (is_keyword(tokens[pos], "BETWEEN")) {
+      pos++;
+      node->kind = Node::BETWEEN;
+      parse_operand(node->operands[1]);
+      if (!is_keyword(tokens[pos], "AND")) {
+        throw std::runtime_error("AND expected in BETWEEN predicate");
+      }
+      pos++;
+      parse_operand(node->operands[2]);
+    } else if (is_keyword(tokens[pos], "LIKE")) {
+      pos++;
+      node->kind = Node::LIKE;
+      parse_operand(node->operands[1]);
+    } else if (tokens[pos].kind == Token::OP) {
+      const std::string & op = tokens[pos].text;
+      node->kind = Node::COMPARE;
+      if (op == "=") {
+        node->op = Node::EQ;
+      } else if (op == "<>" || op == "!=") {
+        node->op = Node::NE;
+      } else if (op == "<") {
+        node->op = Node::LT;
+      } else if (op == "<=") {
+        node->op = Node::LE;
+      } else if (op == ">") {
+        node->op = Node::GT;
+      } else {
+        node->op = Node::GE;
+      }
+      pos++;
+      parse_operand(node->operands[1]);
+    } else {
+      throw std::runtime_error("comparison operator expected");
+    }
+    return node;
+  }
+
+  void parse_operand(Node::Operand & operand)
+  {
+    const Token & token = tokens[pos];
+    switch (token.kind) {
+      case Token::NUMBER:
+        operand.value = parse_number(token.text);
+        break;
+      case Token::STRING:
+        operand.value.kind = Value::STRING;
+        operand.value.s = token.text;
+        break;
+      case Token::PARAM:
+        {
+          size_t index = strtoul(token.text.c_str(), nullptr, 10);
+          if (index >= parameters.size()) {
+            throw std::runtime_error("parameter %" + token.text + " is not provided");
+          }
+          operand.value = parse_parameter(parameters[index]);
+        }
+        break;
+      case Token::IDENT:
+        if (is_keyword(token, "TRUE") || is_keyword(token, "FALSE")) {
+          operand.value.kind = Value::UNSIGNED;
+          operand.value.u = is_keyword(token, "TRUE") ? 1 : 0;
+        } else {
+          operand.is_field = true;
+          resolve_field(token.text, operand.field);
+        }
+        break;
+      default:
+        throw std::runtime_error("operand expected");
+    }
+    pos++;
+  }
+
+  void resolve_field(const std::string & path, Field & field)
+  {
+    const Layout * current = &layout;
+    size_t start = 0;
+    while (true) {
+      size_t end = path.find('.', start);
+      std::string part = path.substr(start, end == std::string::npos ? end : end - start);
+      bool last = end == std::string::npos;
+
+      Field::Step step = {0, false, 0};
+      size_t bracket = part.find('[');
+      if (bracket != std::string::npos) {
+        if (part.back() != ']' || bracket + 2 >= part.size()) {
+          throw std::runtime_error("invalid field '" + path + "'");
+        }
+        std::string index = part.substr(bracket + 1, part.size() - bracket - 2);
+        char * index_end = nullptr;
+        step.indexed = true;
+        step.index = static_cast<uint32_t>(strtoul(index.c_str(), &index_end, 10));
+        if (*index_end != '\0') {
+          throw std::runtime_error("invalid index in field '" + path + "'");
+        }
+        part = part.substr(0, bracket);
+      }
+
+      if (current == nullptr) {
+        throw std::runtime_error("'" + path + "' does not refer to a primitive field");
+      }
+      bool found = false;
+      for (size_t i = 0; i < current->members.size(); i++) {
+        if (current->members[i].name == part) {
+          step.member = i;
+          found = true;
+          break;
+        }
+      }
+      if (!found) {
+        throw std::runtime_error("unknown field '" + path + "'");
+      }
+
+      auto & member = current->members[step.member];
+      if (member.is_array != step.indexed) {
+        throw std::runtime_error(
+                member.is_array ?
+                "array field '" + path + "' must be indexed" :
+                "field '" + path + "' is not an array");
+      }
+      field.steps.push_back(step);
+
+      if (last) {
+        if (member.type_id == ROS_TYPE_MESSAGE) {
+          throw std::runtime_error("'" + path + "' does not refer to a primitive field");
+        }
+        return;
+      }
+      current = member.nested.get();
+      start = end + 1;
+    }
+  }
+
+  const Layout & layout;
+  const std::vector<std::string> & parameters;
+  std::vector<Token> tokens;
+  size_t pos;
+};
+
+// ================================================================================================
+// Evaluation
+
+double to_double(const Value & value)
+{
+  switch (value.kind) {
+    case Value::SIGNED:
+      return static_cast<double>(value.i);
+    case Value::UNSIGNED:
+      return static_cast<double>(value.u);
+    default:
+      return value.f;
+  }
+}
+
+// Returns false if the values cannot be compared
+bool compare(const Value & a, const Value & b, int & result)
+{
+  if (a.kind == Value::NONE || b.kind == Value::NONE) {
+    return false;
+  }
+
+  if (a.kind == Value::STRING || b.kind == Value::STRING) {
+    if (a.kind != b.kind) {
+      return false;
+    }
+    int cmp = a.s.compare(b.s);
+    result = cmp < 0 ? -1 : (cmp > 0 ? 1 : 0);
+    return true;
+  }
+
+  if (a.kind == Value::FLOAT || b.kind == Value::FLOAT) {
+    double x = to_double(a);
+    double y = to_double(b);
+    if (x != x || y != y) {
+      return false;
+    }
+    result = x < y ? -1 : (x > y ? 1 : 0);
+    return true;
+  }
+
+  if (a.kind == Value::SIGNED && b.kind == Value::SIGNED) {
+    result = a.i < b.i ? -1 : (a.i > b.i ? 1 : 0);
+  } else if (a.kind == Value::UNSIGNED && b.kind == Value::UNSIGNED) {
+    result = a.u < b.u ? -1 : (a.u > b.u ? 1 : 0);
+  } else if (a.kind == Value::SIGNED) {
+    uint64_t x = static_cast<uint64_t>(a.i);
+    result = a.i < 0 || x < b.u ? -1 : (x > b.u ? 1 : 0);
+  } else {
+    uint64_t y = static_cast<uint64_t>(b.i);
+    result = b.i < 0 || a.u > y ? 1 : (a.u < y ? -1 : 0);
+  }
+  return true;
+}
+
+bool like(const char * str, const char * pattern)
+{
+  while (*pattern != '\0') {
+    if (*pattern == '%') {
+      while (*pattern == '%') {
+        pattern++;
+      }
+      if (*pattern == '\0') {
+        return true;
+      }
+      for (; *str != '\0'; str++) {
+        if (like(str, pattern)) {
+          return true;
+        }
+      }
+      return false;
+    }
+    if (*str == '\0' || (*pattern != '_' && *pattern != *str)) {
+      return false;
+    }
+    str++;
+    pattern++;
+  }
+  return *str == '\0';
+}
+
+class Evaluator
+{
+public:
+  Evaluator(const Layout & a_layout, uint8_t * a_sample, size_t a_size)
+  : layout(a_layout), sample(a_sample), size(a_size) {}
+
+  bool eval(const Node & node)
+  {
+    Value values[3];
+    int result = 0;
+    int upper = 0;
+
+    switch (node.kind) {
+      case Node::AND:
+        return eval(*node.lhs) && eval(*node.rhs);
+      case Node::OR:
+        return eval(*node.lhs) || eval(*node.rhs);
+      case Node::NOT:
+        return !eval(*node.lhs);
+      case Node::COMPARE:
+        if (!load(node.operands[0], values[0]) || !load(node.operands[1], values[1]) ||
+          !compare(values[0], values[1], result))
+        {
+          return false;
+        }
+        switch (node.op) {
+          case Node::EQ:
+            return result == 0;
+          case Node::NE:
+            return result != 0;
+          case Node::LT:
+            return result < 0;
+          case Node::LE:
+            return result <= 0;
+          case Node::GT:
+            return result > 0;
+          default:
+            return result >= 0;
+        }
+      case Node::BETWEEN:
+        if (!load(node.operands[0], values[0]) || !load(node.operands[1], values[1]) ||
+          !load(node.operands[2], values[2]) || !compare(values[0], values[1], result) ||
+          !compare(values[0], values[2], upper))
+        {
+          return false;
+        }
+        return (result >= 0 && upper <= 0) != node.negate;
+      case Node::LIKE:
+        if (!load(node.operands[0], values[0]) || !load(node.operands[1], values[1]) ||
+          values[0].kind != Value::STRING || values[1].kind != Value::STRING)
+        {
+          return false;
+        }
+        return like(values[0].s.c_str(), values[1].s.c_str()) != node.negate;
+      default:
+        return false;
+    }
+  }
+
+private:
+  bool load(const Node::Operand & operand, Value & value)
+  {
+    if (!operand.is_field) {
+      value = operand.value;
+      return true;
+    }
+    CDRFieldReader reader(sample, size);
+    return read_field(layout, operand.field, reader, value);
+  }
+
+  const Layout & layout;
+  uint8_t * sample;
+  size_t size;
+};
+}  // namespace
+
+ContentFilter::ContentFilter() = default;
+
+ContentFilter::~ContentFilter() = default;
+
+std::shared_ptr<ContentFilter>
+ContentFilter::create(
+  const rosidl_message_type_support_t * type_support,
+  const std::string & expression,
+  const std::vector<std::string> & parameters)
+{
+  std::shared_ptr<ContentFilter> filter(new ContentFilter());
+  filter->expression = expression;
+  filter->parameters = parameters;
+
+  if (type_support->typesupport_identifier == rosidl_typesupport_introspection_c__identifier) {
+    filter->layout = build_layout(
+      static_cast<const rosidl_typesupport_introspection_c__MessageMembers *>(type_support->data));
+  } else if (type_support->typesupport_identifier ==   // NOLINT
+    rosidl_typesupport_introspection_cpp::typesupport_identifier)
+  {
+    filter->layout = build_layout(
+      static_cast<const rosidl_typesupport_introspection_cpp::MessageMembers *>(
+        type_support->data));
+  } else {
+    RMW_SET_ERROR_MSG("Unknown typesupport identifier");
+    return nullptr;
+  }
+
+  try {
+    Parser parser(*filter->layout, expression, parameters);
+    filter->root = parser.parse();
+  } catch (const std::runtime_error & e) {
+    RMW_SET_ERROR_MSG_WITH_FORMAT_STRING(
+      "invalid content filter expression '%s': %s", expression.c_str(), e.what());
+    return nullptr;
+  }
+
+  return filter;
+}
+
+bool ContentFilter::evaluate(const void * sample, size_t size) const
+{
+  try {
+    Evaluator evaluator(*layout, static_cast<uint8_t *>(const_cast<void *>(sample)), size);
+    return evaluator.eval(*root);
+  } catch (const std::runtime_error &) {
+    // Malformed samples never match
+    return false;
+  }
+}
@@ -0,0 +1,65 @@
+// Copyright 2019 GurumNetworks, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CONTENT_FILTER_HPP_
+#define CONTENT_FILTER_HPP_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "rosidl_runtime_c/message_type_support_struct.h"
+
+// Reader-side evaluator for the DDS-SQL filter subset of DDS 1.4 Annex B.
+// Filters are compiled once against the introspection type support and then
+// evaluated directly on the serialized CDR sample, before deserialization.
+class ContentFilter
+{
+public:
+  // Returns nullptr and sets the rmw error message if the expression is invalid
+  static std::shared_ptr<ContentFilter> create(
+    const rosidl_message_type_support_t * type_support,
+    const std::string & expression,
+    const std::vector<std::string> & parameters);
+
+  ~ContentFilter();
+
+  bool evaluate(const void * sample, size_t size) const;
+
+  const std::string & get_expression() const
+  {
+    return expression;
+  }
+
+  const std::vector<std::string> & get_parameters() const
+  {
+    return parameters;
+  }
+
+  struct Layout;
+  struct Field;
+  struct Value;
+  struct Node;
+
+private:
+  ContentFilter();
+
+  std::string expression;
+  std::vector<std::string> parameters;
+
+  std::unique_ptr<Layout> layout;
+  std::unique_ptr<Node> root;
+};
+
+#endif  // CONTENT_FILTER_HPP_
@@ -0,0 +1,189 @@
+// Copyright 2019 GurumNetworks, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+#include <new>
+
+#include "rmw/allocators.h"
+#include "rmw/error_handling.h"
+
+#include "rosidl_runtime_c/message_initialization.h"
+#include "rosidl_runtime_cpp/message_initialization.hpp"
+
+#include "rosidl_typesupport_introspection_c/identifier.h"
+#include "rosidl_typesupport_introspection_c/message_introspection.h"
+
+#include "rosidl_typesupport_introspection_cpp/identifier.hpp"
+#include "rosidl_typesupport_introspection_cpp/message_introspection.hpp"
+
+#include "./message_pool.hpp"
+
+MessagePool::MessagePool(const rosidl_message_type_support_t * type_support)
+: type_support(type_support),
+  prepared_count(0),
+  prepared_limit(0)
+{}
+
+MessagePool::~MessagePool()
+{
+  // Messages still on loan are leaked rather than freed under the borrower
+  for (void * message : free_messages) {
+    destroy_message(message);
+  }
+}
+
+bool MessagePool::is_supported() const
+{
+  const char * identifier = type_support->typesupport_identifier;
+  return identifier == rosidl_typesupport_introspection_c__identifier ||
+         identifier == rosidl_typesupport_introspection_cpp::typesupport_identifier;
+}
+
+void * MessagePool::borrow()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  void * message = nullptr;
+  if (!free_messages.empty()) {
+    message = free_messages.back();
+    free_messages.pop_back();
+  } else {
+    message = create_message();
+    if (message == nullptr) {
+      return nullptr;
+    }
+  }
+
+  loaned_messages.insert(message);
+  return message;
+}
+
+bool MessagePool::give_back(void * message)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  if (loaned_messages.erase(message) == 0) {
+    return false;
+  }
+
+  free_messages.push_back(message);
+  return true;
+}
+
+void MessagePool::set_prepared_limit(size_t limit)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  prepared_limit = limit;
+}
+
+void * MessagePool::borrow_prepared()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (prepared_count >= prepared_limit) {
+      return nullptr;
+    }
+    prepared_count++;
+  }
+
+  void * message = borrow();
+  if (message == nullptr) {
+    std::lock_guard<std::mutex> lock(mutex);
+    prepared_count--;
+  }
+  return message;
+}
+
+void MessagePool::claim_prepared(void * message)
+{
+  (void)message;
+  std::lock_guard<std::mutex> lock(mutex);
+  prepared_count--;
+}
+
+bool MessagePool::can_swap_prepared() const
+{
+  // C messages own their memory through plain pointers, so swapping the
+  // structs swaps ownership. C++ containers may point into themselves.
+  return type_support->typesupport_identifier == rosidl_typesupport_introspection_c__identifier;
+}
+
+bool MessagePool::swap_prepared(void * message, void * ros_message)
+{
+  if (!can_swap_prepared()) {
+    return false;
+  }
+
+  auto members =
+    static_cast<const rosidl_typesupport_introspection_c__MessageMembers *>(type_support->data);
+  std::swap_ranges(
+    static_cast<uint8_t *>(message), static_cast<uint8_t *>(message) + members->size_of_,
+    static_cast<uint8_t *>(ros_message));
+  release_message(message);
+  return true;
+}
+
+void MessagePool::release_message(void * message)
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    prepared_count--;
+  }
+  give_back(message);
+}
+
+void * MessagePool::create_message()
+{
+  const char * identifier = type_support->typesupport_identifier;
+  void * message = nullptr;
+  if (identifier == rosidl_typesupport_introspection_c__identifier) {
+    auto members =
+      static_cast<const rosidl_typesupport_introspection_c__MessageMembers *>(type_support->data);
+    message = rmw_allocate(members->size_of_);
+    if (message != nullptr) {
+      members->init_function(message, ROSIDL_RUNTIME_C_MSG_INIT_ALL);
+    }
+  } else if (identifier == rosidl_typesupport_introspection_cpp::typesupport_identifier) {
+    auto members =
+      static_cast<const rosidl_typesupport_introspection_cpp::MessageMembers *>(type_support->data);
+    message = rmw_allocate(members->size_of_);
+    if (message != nullptr) {
+      members->init_function(message, rosidl_runtime_cpp::MessageInitialization::ALL);
+    }
+  } else {
+    RMW_SET_ERROR_MSG("Unknown typesupport identifier");
+    return nullptr;
+  }
+
+  if (message == nullptr) {
+    RMW_SET_ERROR_MSG("failed to allocate loaned message");
+  }
+  return message;
+}
+
+void MessagePool::destroy_message(void * message)
+{
+  const char * identifier = type_support->typesupport_identifier;
+  if (identifier == rosidl_typesupport_introspection_c__identifier) {
+    auto members =
+      static_cast<const rosidl_typesupport_introspection_c__MessageMembers *>(type_support->data);
+    members->fini_function(message);
+  } else if (identifier == rosidl_typesupport_introspection_cpp::typesupport_identifier) {
+    auto members =
+      static_cast<const rosidl_typesupport_introspection_cpp::MessageMembers *>(type_support->data);
+    members->fini_function(message);
+  }
+
+  rmw_free(message);
+}
@@ -0,0 +1,81 @@
+// Copyright 2019 GurumNetworks, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef MESSAGE_POOL_HPP_
+#define MESSAGE_POOL_HPP_
+
+#include <mutex>
+#include <unordered_set>
+#include <vector>
+
+#include "rosidl_runtime_c/message_type_support_struct.h"
+
+#include "rmw_gurumdds_shared_cpp/types.hpp"
+
+// Initialized ROS messages that are loaned to the application by
+// rmw_take_loaned_message(). Returned messages are kept and reused, so their
+// sequences and strings keep their capacity for the next deserialization.
+// Messages deserialized on arrival are borrowed from here as well, at most
+// prepared_limit of them at a time.
+class MessagePool : public GurumddsMessageOwner
+{
+public:
+  explicit MessagePool(const rosidl_message_type_support_t * type_support);
+  ~MessagePool();
+
+  MessagePool(const MessagePool &) = delete;
+  MessagePool & operator=(const MessagePool &) = delete;
+
+  // Whether messages of the type support can be created by the pool
+  bool is_supported() const;
+
+  // Returns nullptr and sets the rmw error message if allocation fails
+  void * borrow();
+
+  // Returns false if the message was not borrowed from this pool
+  bool give_back(void * message);
+
+  void set_prepared_limit(size_t limit);
+
+  // Borrows a message to deserialize a sample into before it is taken.
+  // Returns nullptr if prepared_limit messages are already waiting.
+  void * borrow_prepared();
+
+  // Hands a prepared message over to the taker, who gives it back like any borrowed message
+  void claim_prepared(void * message);
+
+  // Only C messages can be moved by swap_prepared()
+  bool can_swap_prepared() const;
+
+  // Moves a prepared message into ros_message and gives the prepared one back.
+  // Returns false for C++ messages.
+  bool swap_prepared(void * message, void * ros_message);
+
+  // Gives back a prepared message that was not taken
+  void release_message(void * message) override;
+
+private:
+  void * create_message();
+  void destroy_message(void * message);
+
+  const rosidl_message_type_support_t * type_support;
+
+  std::mutex mutex;
+  std::vector<void *> free_messages;
+  std::unordered_set<void *> loaned_messages;
+  size_t prepared_count;
+  size_t prepared_limit;
+};
+
+#endif  // MESSAGE_POOL_HPP_
@@ -28,6 +28,7 @@
 #include "rmw/impl/cpp/macros.hpp"
 #include "rmw/types.h"
 
+#include "rmw_gurumdds_shared_cpp/rmw_common.hpp"
 #include "rmw_gurumdds_shared_cpp/types.hpp"
 #include "rmw_gurumdds_shared_cpp/qos.hpp"
 #include "rmw_gurumdds_shared_cpp/namespace_prefix.hpp"
@@ -336,6 +337,11 @@ rmw_create_client(
     goto fail;
   }
 
+  if (!client_info->message_queue.init(get_message_queue_capacity(&datareader_qos))) {
+    RMW_SET_ERROR_MSG("failed to allocate message queue");
+    goto fail;
+  }
+
   datareader_listener.on_data_available = reader_on_data_available<GurumddsClientInfo>;
 
   response_reader = dds_Subscriber_create_datareader(
@@ -353,8 +359,6 @@ rmw_create_client(
     goto fail;
   }
 
-  dds_DataReader_set_listener_context(client_info->response_reader, client_info);
-
   queue_guard_condition = dds_GuardCondition_create();
   if (queue_guard_condition == nullptr) {
     RMW_SET_ERROR_MSG("failed to create guard condition");
@@ -362,6 +366,8 @@ rmw_create_client(
   }
   client_info->queue_guard_condition = queue_guard_condition;
 
+  dds_DataReader_set_listener_context(client_info->response_reader, client_info);
+
   // Set GUID
   guid_temp = uniform_dist(dre);
   memcpy(client_info->writer_guid, &guid_temp, sizeof(guid_temp));
@@ -428,6 +434,7 @@ fail:
   }
 
   if (client_info != nullptr) {
+    message_queue_clear(client_info->message_queue);
     delete client_info;
   }
   return nullptr;
@@ -506,20 +513,13 @@ rmw_destroy_client(rmw_node_t * node, rmw_client_t * client)
     }
 
     if (client_info->queue_guard_condition != nullptr) {
+      shared__rmw_wait_set_forget_condition(
+        reinterpret_cast<dds_Condition *>(client_info->queue_guard_condition));
       dds_GuardCondition_delete(client_info->queue_guard_condition);
       client_info->queue_guard_condition = nullptr;
     }
 
-    while (!client_info->message_queue.empty()) {
-      auto msg = client_info->message_queue.front();
-      if (msg.sample != nullptr) {
-        dds_free(msg.sample);
-      }
-      if (msg.info != nullptr) {
-        dds_free(msg.info);
-      }
-      client_info->message_queue.pop();
-    }
+    message_queue_clear(client_info->message_queue);
 
     delete client_info;
     client->data = nullptr;
@@ -644,4 +644,26 @@ rmw_service_server_is_available(
 
   return RMW_RET_OK;
 }
+
+rmw_ret_t
+rmw_client_set_on_new_response_callback(
+  rmw_client_t * client,
+  rmw_event_callback_t callback,
+  const void * user_data)
+{
+  RMW_CHECK_ARGUMENT_FOR_NULL(client, RMW_RET_INVALID_ARGUMENT);
+  RMW_CHECK_TYPE_IDENTIFIERS_MATCH(
+    client handle,
+    client->implementation_identifier, gurum_gurumdds_identifier,
+    return RMW_RET_INCORRECT_RMW_IMPLEMENTATION)
+
+  auto info = static_cast<GurumddsClientInfo *>(client->data);
+  if (info == nullptr) {
+    RMW_SET_ERROR_MSG("client internal data is invalid");
+    return RMW_RET_ERROR;
+  }
+
+  info->new_message_callback.set(callback, user_data);
+  return RMW_RET_OK;
+}
 }  // extern "C"
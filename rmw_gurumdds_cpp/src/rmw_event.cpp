@@ -54,4 +54,13 @@ rmw_take_event(
 {
   return shared__rmw_take_event(gurum_gurumdds_identifier, event_handle, event_info, taken);
 }
+
+rmw_ret_t
+rmw_event_set_callback(
+  rmw_event_t * rmw_event,
+  rmw_event_callback_t callback,
+  const void * user_data)
+{
+  return shared__rmw_event_set_callback(gurum_gurumdds_identifier, rmw_event, callback, user_data);
+}
 }  // extern "C"
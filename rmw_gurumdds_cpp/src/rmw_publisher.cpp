@@ -12,15 +12,17 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
 #include <string>
-#include <sstream>
 #include <limits>
+#include <mutex>
 #include <thread>
 #include <chrono>
 
 #include "rmw/allocators.h"
 #include "rmw/error_handling.h"
 #include "rmw/rmw.h"
+#include "rmw/time.h"
 #include "rmw/impl/cpp/macros.hpp"
 #include "rmw/types.h"
 
@@ -29,6 +31,7 @@
 #include "rmw_gurumdds_shared_cpp/qos.hpp"
 #include "rmw_gurumdds_shared_cpp/namespace_prefix.hpp"
 #include "rmw_gurumdds_cpp/identifier.hpp"
+#include "rmw_gurumdds_cpp/publisher.hpp"
 #include "rmw_gurumdds_cpp/types.hpp"
 
 #include "rcutils/types.h"
@@ -36,6 +39,86 @@
 
 #include "./type_support_common.hpp"
 
+// Everything written before written_count was sampled is acknowledged
+static void
+_update_acked_count(GurumddsPublisherInfo * info, uint64_t written_count)
+{
+  uint64_t acked_count = info->acked_count.load();
+  while (acked_count < written_count &&
+    !info->acked_count.compare_exchange_weak(acked_count, written_count))
+  {
+  }
+}
+
+// Samples the writer can hold without acknowledgment. Reliable writers keep
+// them in their history, which KEEP_LAST bounds by depth and KEEP_ALL by
+// resource limits; best-effort writers never wait for acknowledgments.
+static size_t
+_get_unacked_limit(const dds_DataWriterQos * datawriter_qos)
+{
+  if (datawriter_qos->reliability.kind != dds_RELIABLE_RELIABILITY_QOS) {
+    return 0;
+  }
+
+  if (datawriter_qos->history.kind == dds_KEEP_LAST_HISTORY_QOS) {
+    return datawriter_qos->history.depth > 0 ?
+           static_cast<size_t>(datawriter_qos->history.depth) : 1;
+  }
+
+  if (datawriter_qos->resource_limits.max_samples > 0) {
+    return static_cast<size_t>(datawriter_qos->resource_limits.max_samples);
+  }
+
+  return std::numeric_limits<size_t>::max();
+}
+
+static void
+_notify_backpressure(
+  const rmw_publisher_t * publisher, GurumddsPublisherInfo * info, bool blocked)
+{
+  std::lock_guard<std::mutex> lock(info->backpressure_mutex);
+  if (info->backpressure_callback != nullptr) {
+    info->backpressure_callback(publisher, blocked, info->backpressure_user_data);
+  }
+}
+
+// Maps the result of a write and tracks backpressure transitions.
+// Nothing is allocated here, as it runs on every publish.
+static rmw_ret_t
+_check_write_result(
+  const rmw_publisher_t * publisher, GurumddsPublisherInfo * info, dds_ReturnCode_t ret)
+{
+  if (ret == dds_RETCODE_OK) {
+    info->written_count.fetch_add(1, std::memory_order_relaxed);
+    if (info->blocked.load(std::memory_order_relaxed) && info->blocked.exchange(false)) {
+      _notify_backpressure(publisher, info, false);
+    }
+    return RMW_RET_OK;
+  }
+
+  bool history_full = ret == dds_RETCODE_TIMEOUT || ret == dds_RETCODE_OUT_OF_RESOURCES;
+  if (history_full && !info->blocked.exchange(true)) {
+    _notify_backpressure(publisher, info, true);
+  }
+
+  if (history_full && info->non_blocking) {
+    RMW_SET_ERROR_MSG("failed to publish data: writer history is full");
+    return rmw_gurumdds_cpp::RET_WOULD_BLOCK;
+  }
+
+  const char * errstr;
+  if (ret == dds_RETCODE_TIMEOUT) {
+    errstr = "dds_RETCODE_TIMEOUT";
+  } else if (ret == dds_RETCODE_OUT_OF_RESOURCES) {
+    errstr = "dds_RETCODE_OUT_OF_RESOURCES";
+  } else {
+    errstr = "dds_RETCODE_ERROR";
+  }
+  RMW_SET_ERROR_MSG_WITH_FORMAT_STRING(
+    "failed to publish data: %s, %d", errstr, static_cast<int>(ret));
+  return RMW_RET_ERROR;
+}
+
 extern "C"
 {
 rmw_ret_t
@@ -126,12 +209,17 @@ rmw_create_publisher(
     }
   }
 
+  auto payload = static_cast<const rmw_gurumdds_cpp::PublisherPayload *>(
+    publisher_options->rmw_specific_publisher_payload);
+  bool non_blocking = payload != nullptr && payload->non_blocking;
+
   rmw_publisher_t * rmw_publisher = nullptr;
   GurumddsPublisherInfo * publisher_info = nullptr;
   dds_Publisher * dds_publisher = nullptr;
   dds_PublisherQos publisher_qos;
   dds_DataWriter * topic_writer = nullptr;
   dds_DataWriterQos datawriter_qos;
+  size_t unacked_limit = 0;
   dds_Topic * topic = nullptr;
   dds_TopicDescription * topic_desc = nullptr;
   dds_TypeSupport * dds_typesupport = nullptr;
@@ -229,11 +317,18 @@ rmw_create_publisher(
     goto fail;
   }
 
+  if (non_blocking) {
+    // A full reliable history makes the write fail immediately instead of blocking
+    datawriter_qos.reliability.max_blocking_time.sec = 0;
+    datawriter_qos.reliability.max_blocking_time.nanosec = 0;
+  }
+
   topic_writer = dds_Publisher_create_datawriter(dds_publisher, topic, &datawriter_qos, nullptr, 0);
   if (topic_writer == nullptr) {
     RMW_SET_ERROR_MSG("failed to create datawriter");
     goto fail;
   }
+  unacked_limit = _get_unacked_limit(&datawriter_qos);
 
   ret = dds_DataWriterQos_finalize(&datawriter_qos);
   if (ret != dds_RETCODE_OK) {
@@ -252,6 +347,8 @@ rmw_create_publisher(
   publisher_info->topic_writer = topic_writer;
   publisher_info->dds_typesupport = dds_typesupport;
   publisher_info->rosidl_message_typesupport = type_support;
+  publisher_info->non_blocking = non_blocking;
+  publisher_info->unacked_limit = unacked_limit;
   publisher_info->publisher_gid.implementation_identifier = gurum_gurumdds_identifier;
 
   static_assert(
@@ -390,6 +487,52 @@ rmw_publisher_assert_liveliness(const rmw_publisher_t * publisher)
   return RMW_RET_OK;
 }
 
+rmw_ret_t
+rmw_publisher_wait_for_all_acked(const rmw_publisher_t * publisher, rmw_time_t wait_timeout)
+{
+  RMW_CHECK_ARGUMENT_FOR_NULL(publisher, RMW_RET_INVALID_ARGUMENT);
+  RMW_CHECK_TYPE_IDENTIFIERS_MATCH(
+    publisher handle,
+    publisher->implementation_identifier, gurum_gurumdds_identifier,
+    return RMW_RET_INCORRECT_RMW_IMPLEMENTATION)
+
+  auto info = static_cast<GurumddsPublisherInfo *>(publisher->data);
+  if (info == nullptr) {
+    RMW_SET_ERROR_MSG("publisher internal data is invalid");
+    return RMW_RET_ERROR;
+  }
+
+  if (info->topic_writer == nullptr) {
+    RMW_SET_ERROR_MSG("publisher internal datawriter is invalid");
+    return RMW_RET_ERROR;
+  }
+
+  dds_Duration_t timeout;
+  if (rmw_time_equal(wait_timeout, RMW_DURATION_INFINITE) ||
+    wait_timeout.sec >= static_cast<uint64_t>(std::numeric_limits<int32_t>::max()))
+  {
+    timeout.sec = dds_DURATION_INFINITE_SEC;
+    timeout.nanosec = dds_DURATION_INFINITE_NSEC;
+  } else {
+    timeout.sec = static_cast<int32_t>(wait_timeout.sec);
+    timeout.nanosec = static_cast<uint32_t>(wait_timeout.nsec);
+  }
+
+  uint64_t written_count = info->written_count.load();
+  dds_ReturnCode_t ret = dds_DataWriter_wait_for_acknowledgments(info->topic_writer, &timeout);
+  if (ret == dds_RETCODE_TIMEOUT) {
+    return RMW_RET_TIMEOUT;
+  }
+  if (ret != dds_RETCODE_OK) {
+    RMW_SET_ERROR_MSG("failed to wait for acknowledgments");
+    return RMW_RET_ERROR;
+  }
+
+  _update_acked_count(info, written_count);
+
+  return RMW_RET_OK;
+}
+
 rmw_ret_t
 rmw_destroy_publisher(rmw_node_t * node, rmw_publisher_t * publisher)
 {
@@ -429,6 +572,9 @@ rmw_destroy_publisher(rmw_node_t * node, rmw_publisher_t * publisher)
 
     if (dds_publisher != nullptr) {
       if (publisher_info->topic_writer != nullptr) {
+        shared__rmw_wait_set_forget_condition(
+          reinterpret_cast<dds_Condition *>(
+            dds_DataWriter_get_statuscondition(publisher_info->topic_writer)));
         ret = dds_Publisher_delete_datawriter(dds_publisher, publisher_info->topic_writer);
         if (ret != dds_RETCODE_OK) {
           RMW_SET_ERROR_MSG("failed to delete datawriter");
@@ -659,27 +805,16 @@ rmw_publish(
   );
   if (!result) {
     RMW_SET_ERROR_MSG("failed to serialize message");
+    free(dds_message);
     return RMW_RET_ERROR;
   }
 
   dds_ReturnCode_t ret = dds_DataWriter_raw_write(topic_writer, dds_message, size);
-  const char * errstr;
-  if (ret == dds_RETCODE_OK) {
-    errstr = "dds_RETCODE_OK";
-  } else if (ret == dds_RETCODE_TIMEOUT) {
-    errstr = "dds_RETCODE_TIMEOUT";
-  } else if (ret == dds_RETCODE_OUT_OF_RESOURCES) {
-    errstr = "dds_RETCODE_OUT_OF_RESOURCES";
-  } else {
-    errstr = "dds_RETCODE_ERROR";
-  }
-
-  if (ret != dds_RETCODE_OK) {
-    std::stringstream errmsg;
-    errmsg << "failed to publish data: " << errstr << ", " << ret;
-    RMW_SET_ERROR_MSG(errmsg.str().c_str());
+  rmw_ret_t rmw_ret = _check_write_result(publisher, info, ret);
+  if (rmw_ret != RMW_RET_OK) {
+    // Error message already set
     free(dds_message);
-    return RMW_RET_ERROR;
+    return rmw_ret;
   }
   const char * topic_name = dds_Topic_get_name(dds_DataWriter_get_topic(topic_writer));
   RCUTILS_LOG_DEBUG_NAMED("rmw_gurumdds_cpp", "Published data on topic %s", topic_name);
@@ -711,22 +846,10 @@ rmw_publish_serialized_message(
     serialized_message->buffer,
     static_cast<uint32_t>(serialized_message->buffer_length)
   );
-  const char * errstr;
-  if (ret == dds_RETCODE_OK) {
-    errstr = "dds_RETCODE_OK";
-  } else if (ret == dds_RETCODE_TIMEOUT) {
-    errstr = "dds_RETCODE_TIMEOUT";
-  } else if (ret == dds_RETCODE_OUT_OF_RESOURCES) {
-    errstr = "dds_RETCODE_OUT_OF_RESOURCES";
-  } else {
-    errstr = "dds_RETCODE_ERROR";
-  }
-
-  if (ret != dds_RETCODE_OK) {
-    std::stringstream errmsg;
-    errmsg << "failed to publish data: " << errstr << ", " << ret;
-    RMW_SET_ERROR_MSG(errmsg.str().c_str());
-    return RMW_RET_ERROR;
+  rmw_ret_t rmw_ret = _check_write_result(publisher, info, ret);
+  if (rmw_ret != RMW_RET_OK) {
+    // Error message already set
+    return rmw_ret;
   }
   const char * topic_name = dds_Topic_get_name(dds_DataWriter_get_topic(topic_writer));
   RCUTILS_LOG_DEBUG_NAMED("rmw_gurumdds_cpp", "Published data on topic %s", topic_name);
@@ -774,3 +897,73 @@ rmw_return_loaned_message_from_publisher(
   return RMW_RET_UNSUPPORTED;
 }
 }  // extern "C"
+
+namespace rmw_gurumdds_cpp
+{
+rmw_ret_t
+set_publisher_backpressure_callback(
+  rmw_publisher_t * publisher,
+  PublisherBackpressureCallback callback,
+  void * user_data)
+{
+  RMW_CHECK_ARGUMENT_FOR_NULL(publisher, RMW_RET_INVALID_ARGUMENT);
+  RMW_CHECK_TYPE_IDENTIFIERS_MATCH(
+    publisher handle,
+    publisher->implementation_identifier, gurum_gurumdds_identifier,
+    return RMW_RET_INCORRECT_RMW_IMPLEMENTATION)
+
+  auto info = static_cast<GurumddsPublisherInfo *>(publisher->data);
+  if (info == nullptr) {
+    RMW_SET_ERROR_MSG("publisher internal data is invalid");
+    return RMW_RET_ERROR;
+  }
+
+  std::lock_guard<std::mutex> lock(info->backpressure_mutex);
+  info->backpressure_callback = callback;
+  info->backpressure_user_data = user_data;
+
+  return RMW_RET_OK;
+}
+
+rmw_ret_t
+get_publisher_unacked_count(const rmw_publisher_t * publisher, size_t * count)
+{
+  RMW_CHECK_ARGUMENT_FOR_NULL(publisher, RMW_RET_INVALID_ARGUMENT);
+  RMW_CHECK_ARGUMENT_FOR_NULL(count, RMW_RET_INVALID_ARGUMENT);
+  RMW_CHECK_TYPE_IDENTIFIERS_MATCH(
+    publisher handle,
+    publisher->implementation_identifier, gurum_gurumdds_identifier,
+    return RMW_RET_INCORRECT_RMW_IMPLEMENTATION)
+
+  auto info = static_cast<GurumddsPublisherInfo *>(publisher->data);
+  if (info == nullptr || info->topic_writer == nullptr) {
+    RMW_SET_ERROR_MSG("publisher internal data is invalid");
+    return RMW_RET_ERROR;
+  }
+
+  uint64_t written_count = info->written_count.load();
+  if (info->acked_count.load() < written_count) {
+    // A zero timeout only checks the acknowledgment state, it never waits
+    dds_Duration_t timeout;
+    timeout.sec = 0;
+    timeout.nanosec = 0;
+    dds_ReturnCode_t ret = dds_DataWriter_wait_for_acknowledgments(info->topic_writer, &timeout);
+    if (ret == dds_RETCODE_OK) {
+      _update_acked_count(info, written_count);
+    } else if (ret != dds_RETCODE_TIMEOUT) {
+      RMW_SET_ERROR_MSG("failed to check acknowledgments");
+      return RMW_RET_ERROR;
+    }
+  }
+
+  uint64_t acked_count = info->acked_count.load();
+  written_count = info->written_count.load();
+  uint64_t unacked_count = written_count > acked_count ? written_count - acked_count : 0;
+  // Acknowledgments are only seen once everything written is acknowledged,
+  // which continuous publishing may never allow, but the writer can't hold
+  // more unacknowledged samples than its history
+  *count = static_cast<size_t>(std::min<uint64_t>(unacked_count, info->unacked_limit));
+
+  return RMW_RET_OK;
+}
+}  // namespace rmw_gurumdds_cpp
@@ -155,18 +155,11 @@ rmw_take_request(
     return RMW_RET_ERROR;
   }
 
-  if (service_info->message_queue.empty()) {
+  GurumddsMessage msg;
+  if (!message_queue_pop(service_info->message_queue, service_info->queue_guard_condition, msg)) {
     return RMW_RET_OK;
   }
 
-  service_info->queue_mutex.lock();
-  auto msg = service_info->message_queue.front();
-  service_info->message_queue.pop();
-  if (service_info->message_queue.empty()) {
-    dds_GuardCondition_set_trigger_value(service_info->queue_guard_condition, false);
-  }
-  service_info->queue_mutex.unlock();
-
   if (msg.info->valid_data) {
     if (msg.sample == nullptr) {
       RMW_SET_ERROR_MSG("Received invalid message");
@@ -195,8 +188,7 @@ rmw_take_request(
     request_header->source_timestamp =
       msg.info->source_timestamp.sec * static_cast<int64_t>(1000000000) +
       msg.info->source_timestamp.nanosec;
-    // TODO(clemjh): SampleInfo doesn't contain received_timestamp
-    request_header->received_timestamp = 0;
+    request_header->received_timestamp = msg.received_timestamp;
     request_header->request_id.sequence_number = sequence_number;
     memcpy(request_header->request_id.writer_guid, client_guid, 16);
 
@@ -285,6 +285,11 @@ rmw_create_service(
     goto fail;
   }
 
+  if (!service_info->message_queue.init(get_message_queue_capacity(&datareader_qos))) {
+    RMW_SET_ERROR_MSG("failed to allocate message queue");
+    goto fail;
+  }
+
   datareader_listener.on_data_available = reader_on_data_available<GurumddsServiceInfo>;
 
   request_reader = dds_Subscriber_create_datareader(
@@ -419,6 +424,7 @@ fail:
   }
 
   if (service_info != nullptr) {
+    message_queue_clear(service_info->message_queue);
     delete service_info;
   }
   return nullptr;
@@ -497,20 +503,13 @@ rmw_destroy_service(rmw_node_t * node, rmw_service_t * service)
     }
 
     if (service_info->queue_guard_condition != nullptr) {
+      shared__rmw_wait_set_forget_condition(
+        reinterpret_cast<dds_Condition *>(service_info->queue_guard_condition));
       dds_GuardCondition_delete(service_info->queue_guard_condition);
       service_info->queue_guard_condition = nullptr;
     }
 
-    while (!service_info->message_queue.empty()) {
-      auto msg = service_info->message_queue.front();
-      if (msg.sample != nullptr) {
-        dds_free(msg.sample);
-      }
-      if (msg.info != nullptr) {
-        dds_free(msg.info);
-      }
-      service_info->message_queue.pop();
-    }
+    message_queue_clear(service_info->message_queue);
 
     delete service_info;
     service->data = nullptr;
@@ -531,4 +530,26 @@ rmw_destroy_service(rmw_node_t * node, rmw_service_t * service)
 
   return rmw_ret;
 }
+
+rmw_ret_t
+rmw_service_set_on_new_request_callback(
+  rmw_service_t * service,
+  rmw_event_callback_t callback,
+  const void * user_data)
+{
+  RMW_CHECK_ARGUMENT_FOR_NULL(service, RMW_RET_INVALID_ARGUMENT);
+  RMW_CHECK_TYPE_IDENTIFIERS_MATCH(
+    service handle,
+    service->implementation_identifier, gurum_gurumdds_identifier,
+    return RMW_RET_INCORRECT_RMW_IMPLEMENTATION)
+
+  auto info = static_cast<GurumddsServiceInfo *>(service->data);
+  if (info == nullptr) {
+    RMW_SET_ERROR_MSG("service internal data is invalid");
+    return RMW_RET_ERROR;
+  }
+
+  info->new_message_callback.set(callback, user_data);
+  return RMW_RET_OK;
+}
 }  // extern "C"
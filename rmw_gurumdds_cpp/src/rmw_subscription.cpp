@@ -12,15 +12,21 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <atomic>
 #include <utility>
 #include <string>
 #include <limits>
+#include <memory>
 #include <thread>
 #include <chrono>
+#include <cstdlib>
+#include <vector>
+#include <system_error>
 
 #include "rmw/allocators.h"
 #include "rmw/error_handling.h"
 #include "rmw/serialized_message.h"
+#include "rmw/subscription_content_filter_options.h"
 #include "rmw/rmw.h"
 
 #include "rcutils/error_handling.h"
@@ -34,8 +40,268 @@
 
 #include "rmw_gurumdds_cpp/types.hpp"
 #include "rmw_gurumdds_cpp/identifier.hpp"
+#include "rmw_gurumdds_cpp/subscription.hpp"
 
+#include "./content_filter.hpp"
+#include "./message_pool.hpp"
 #include "./type_support_common.hpp"
+#include "./worker_pool.hpp"
+
+// Leaves content_filter null if options has no filter expression
+static rmw_ret_t
+_compile_content_filter(
+  const rosidl_message_type_support_t * type_support,
+  const rmw_subscription_content_filter_options_t * options,
+  std::shared_ptr<ContentFilter> & content_filter)
+{
+  content_filter = nullptr;
+  if (options == nullptr || options->filter_expression == nullptr ||
+    strlen(options->filter_expression) == 0)
+  {
+    return RMW_RET_OK;
+  }
+
+  std::vector<std::string> parameters;
+  for (size_t i = 0; i < options->expression_parameters.size; i++) {
+    parameters.push_back(options->expression_parameters.data[i]);
+  }
+
+  content_filter = ContentFilter::create(type_support, options->filter_expression, parameters);
+  if (content_filter == nullptr) {
+    // Error message already set
+    return RMW_RET_INVALID_ARGUMENT;
+  }
+
+  return RMW_RET_OK;
+}
+
+static dds_StringSeq *
+_create_expression_parameters(const rmw_subscription_content_filter_options_t * options)
+{
+  dds_StringSeq * dds_parameters =
+    dds_StringSeq_create(static_cast<uint32_t>(options->expression_parameters.size));
+  if (dds_parameters == nullptr) {
+    return nullptr;
+  }
+  for (size_t i = 0; i < options->expression_parameters.size; i++) {
+    dds_StringSeq_add(dds_parameters, const_cast<char *>(options->expression_parameters.data[i]));
+  }
+  return dds_parameters;
+}
+
+static rmw_ret_t
+_create_content_filter(
+  dds_DomainParticipant * participant,
+  dds_Topic * topic,
+  const rosidl_message_type_support_t * type_support,
+  const rmw_subscription_content_filter_options_t * options,
+  std::shared_ptr<ContentFilter> & content_filter,
+  dds_ContentFilteredTopic ** content_filtered_topic)
+{
+  static std::atomic<uint32_t> content_filtered_topic_id(0);
+
+  *content_filtered_topic = nullptr;
+  // The expression is always compiled so that it is validated the same way
+  // whether or not DDS is able to filter on the writer side
+  rmw_ret_t rmw_ret = _compile_content_filter(type_support, options, content_filter);
+  if (rmw_ret != RMW_RET_OK || content_filter == nullptr) {
+    return rmw_ret;
+  }
+
+  dds_StringSeq * dds_parameters = _create_expression_parameters(options);
+  if (dds_parameters == nullptr) {
+    RMW_SET_ERROR_MSG("failed to create expression parameter sequence");
+    content_filter = nullptr;
+    return RMW_RET_ERROR;
+  }
+
+  std::string content_filtered_topic_name = std::string(dds_Topic_get_name(topic)) + "_cft" +
+    std::to_string(content_filtered_topic_id.fetch_add(1));
+  *content_filtered_topic = dds_DomainParticipant_create_contentfilteredtopic(
+    participant, content_filtered_topic_name.c_str(), topic,
+    options->filter_expression, dds_parameters);
+  dds_StringSeq_delete(dds_parameters);
+
+  if (*content_filtered_topic == nullptr) {
+    RCUTILS_LOG_DEBUG_NAMED(
+      "rmw_gurumdds_cpp",
+      "ContentFilteredTopic is not available for '%s', samples are filtered on the reader side",
+      dds_Topic_get_name(topic));
+  }
+
+  return RMW_RET_OK;
+}
+
+static bool
+_use_direct_take(const rmw_subscription_options_t * subscription_options)
+{
+  auto payload = static_cast<const rmw_gurumdds_cpp::SubscriptionPayload *>(
+    subscription_options->rmw_specific_subscription_payload);
+  if (payload != nullptr) {
+    return payload->direct_take && !payload->conflate;
+  }
+
+  const char * env_value = getenv("RMW_GURUMDDS_DIRECT_TAKE");
+  return env_value != nullptr && strcmp(env_value, "1") == 0;
+}
+
+static bool
+_use_loaned_messages(const rmw_subscription_options_t * subscription_options)
+{
+  auto payload = static_cast<const rmw_gurumdds_cpp::SubscriptionPayload *>(
+    subscription_options->rmw_specific_subscription_payload);
+  if (payload != nullptr) {
+    return payload->loan_messages;
+  }
+
+  const char * env_value = getenv("RMW_GURUMDDS_LOAN_MESSAGES");
+  return env_value != nullptr && strcmp(env_value, "1") == 0;
+}
+
+static bool
+_use_conflation(const rmw_subscription_options_t * subscription_options)
+{
+  auto payload = static_cast<const rmw_gurumdds_cpp::SubscriptionPayload *>(
+    subscription_options->rmw_specific_subscription_payload);
+  return payload != nullptr && payload->conflate;
+}
+
+// The take sequences are preallocated for this many samples
+static const uint32_t MAX_SAMPLES_PER_CALLBACK_LIMIT = 4096;
+
+static rmw_ret_t
+_get_max_samples_per_callback(
+  const rmw_subscription_options_t * subscription_options, uint32_t * max_samples_per_callback)
+{
+  *max_samples_per_callback = GURUMDDS_READER_MAX_SAMPLES;
+
+  auto payload = static_cast<const rmw_gurumdds_cpp::SubscriptionPayload *>(
+    subscription_options->rmw_specific_subscription_payload);
+  if (payload != nullptr && payload->max_samples_per_callback > 0) {
+    if (payload->max_samples_per_callback > MAX_SAMPLES_PER_CALLBACK_LIMIT) {
+      RMW_SET_ERROR_MSG_WITH_FORMAT_STRING(
+        "max_samples_per_callback %u exceeds the limit of %u",
+        payload->max_samples_per_callback, MAX_SAMPLES_PER_CALLBACK_LIMIT);
+      return RMW_RET_INVALID_ARGUMENT;
+    }
+    *max_samples_per_callback = payload->max_samples_per_callback;
+    return RMW_RET_OK;
+  }
+
+  const char * env_value = getenv("RMW_GURUMDDS_MAX_SAMPLES_PER_CALLBACK");
+  if (env_value != nullptr) {
+    unsigned long max_samples = strtoul(env_value, nullptr, 10);  // NOLINT
+    if (max_samples > MAX_SAMPLES_PER_CALLBACK_LIMIT) {
+      RMW_SET_ERROR_MSG_WITH_FORMAT_STRING(
+        "RMW_GURUMDDS_MAX_SAMPLES_PER_CALLBACK '%s' exceeds the limit of %u",
+        env_value, MAX_SAMPLES_PER_CALLBACK_LIMIT);
+      return RMW_RET_INVALID_ARGUMENT;
+    }
+    if (max_samples > 0) {
+      *max_samples_per_callback = static_cast<uint32_t>(max_samples);
+    }
+  }
+
+  return RMW_RET_OK;
+}
+
+static uint32_t
+_get_pre_deserialize_depth(const rmw_subscription_options_t * subscription_options)
+{
+  auto payload = static_cast<const rmw_gurumdds_cpp::SubscriptionPayload *>(
+    subscription_options->rmw_specific_subscription_payload);
+  if (payload != nullptr) {
+    return payload->pre_deserialize_depth;
+  }
+
+  const char * env_value = getenv("RMW_GURUMDDS_PRE_DESERIALIZE_DEPTH");
+  if (env_value != nullptr) {
+    unsigned long depth = strtoul(env_value, nullptr, 10);  // NOLINT
+    if (depth <= std::numeric_limits<int32_t>::max()) {
+      return static_cast<uint32_t>(depth);
+    }
+  }
+
+  return 0;
+}
+
+static size_t
+_get_queue_byte_budget(const rmw_subscription_options_t * subscription_options)
+{
+  auto payload = static_cast<const rmw_gurumdds_cpp::SubscriptionPayload *>(
+    subscription_options->rmw_specific_subscription_payload);
+  if (payload != nullptr) {
+    return payload->queue_byte_budget;
+  }
+
+  const char * env_value = getenv("RMW_GURUMDDS_QUEUE_BYTE_BUDGET");
+  if (env_value != nullptr) {
+    return static_cast<size_t>(strtoull(env_value, nullptr, 10));
+  }
+
+  return 0;
+}
+
+static rcutils_duration_value_t
+_get_minimum_separation(const rmw_subscription_options_t * subscription_options)
+{
+  auto payload = static_cast<const rmw_gurumdds_cpp::SubscriptionPayload *>(
+    subscription_options->rmw_specific_subscription_payload);
+  if (payload == nullptr ||
+    payload->minimum_separation >
+    static_cast<uint64_t>(std::numeric_limits<rcutils_duration_value_t>::max()))
+  {
+    return 0;
+  }
+
+  return static_cast<rcutils_duration_value_t>(payload->minimum_separation);
+}
+
+static bool
+_use_queue_drop_newest(const rmw_subscription_options_t * subscription_options)
+{
+  auto payload = static_cast<const rmw_gurumdds_cpp::SubscriptionPayload *>(
+    subscription_options->rmw_specific_subscription_payload);
+  return payload != nullptr &&
+         payload->queue_budget_policy == rmw_gurumdds_cpp::QueueBudgetPolicy::DROP_NEWEST;
+}
+
+// Buffers of serialized messages using this allocator are samples allocated
+// by GurumDDS, so they can only be handed over by a take and released.
+static void *
+_sample_buffer_allocate(size_t size, void * state)
+{
+  (void)size;
+  (void)state;
+  return nullptr;
+}
+
+static void
+_sample_buffer_deallocate(void * pointer, void * state)
+{
+  (void)state;
+  if (pointer != nullptr) {
+    dds_free(pointer);
+  }
+}
+
+static void *
+_sample_buffer_reallocate(void * pointer, size_t size, void * state)
+{
+  (void)pointer;
+  (void)size;
+  (void)state;
+  return nullptr;
+}
+
+static void *
+_sample_buffer_zero_allocate(size_t number_of_elements, size_t size_of_element, void * state)
+{
+  (void)number_of_elements;
+  (void)size_of_element;
+  (void)state;
+  return nullptr;
+}
 
 extern "C"
 {
@@ -136,10 +402,25 @@ rmw_create_subscription(
   dds_DataReaderListener datareader_listener = {};
   dds_Topic * topic = nullptr;
   dds_TopicDescription * topic_desc = nullptr;
+  dds_ContentFilteredTopic * content_filtered_topic = nullptr;
+  std::shared_ptr<ContentFilter> content_filter;
   dds_GuardCondition * queue_guard_condition = nullptr;
+  dds_ReadCondition * read_condition = nullptr;
+  bool direct_take = false;
+  size_t queue_capacity = 0;
   dds_TypeSupport * dds_typesupport = nullptr;
   dds_ReturnCode_t ret = dds_RETCODE_OK;
   rmw_ret_t rmw_ret = RMW_RET_OK;
+  uint32_t max_samples_per_callback = 0;
+
+  if (_get_max_samples_per_callback(subscription_options, &max_samples_per_callback) !=
+    RMW_RET_OK)
+  {
+    // Error message is already set
+    return nullptr;
+  }
+
+  direct_take = _use_direct_take(subscription_options);
 
   std::string type_name =
     create_type_name(type_support->data, type_support->typesupport_identifier);
@@ -228,21 +509,42 @@ rmw_create_subscription(
     }
   }
 
+  rmw_ret = _create_content_filter(
+    participant, topic, type_support, subscription_options->content_filter_options,
+    content_filter, &content_filtered_topic);
+  if (rmw_ret != RMW_RET_OK) {
+    // Error message already set
+    goto fail;
+  }
+
   if (!get_datareader_qos(dds_subscriber, qos_policies, &datareader_qos)) {
     // Error message already set
     goto fail;
   }
+  queue_capacity = get_message_queue_capacity(&datareader_qos);
 
-  datareader_listener.on_data_available = reader_on_data_available<GurumddsSubscriberInfo>;
+  datareader_listener = get_datareader_listener();
 
   topic_reader = dds_Subscriber_create_datareader(
-    dds_subscriber, topic, &datareader_qos, &datareader_listener,
-    dds_DATA_AVAILABLE_STATUS);
+    dds_subscriber,
+    content_filtered_topic != nullptr ?
+    reinterpret_cast<dds_Topic *>(content_filtered_topic) : topic,
+    &datareader_qos, &datareader_listener,
+    dds_SUBSCRIPTION_MATCHED_STATUS | (direct_take ? 0 : dds_DATA_AVAILABLE_STATUS));
   if (topic_reader == nullptr) {
     RMW_SET_ERROR_MSG("failed to create datareader");
     goto fail;
   }
 
+  if (direct_take) {
+    read_condition = dds_DataReader_create_readcondition(
+      topic_reader, dds_ANY_SAMPLE_STATE, dds_ANY_VIEW_STATE, dds_ANY_INSTANCE_STATE);
+    if (read_condition == nullptr) {
+      RMW_SET_ERROR_MSG("failed to create read condition");
+      goto fail;
+    }
+  }
+
   ret = dds_DataReaderQos_finalize(&datareader_qos);
   if (ret != dds_RETCODE_OK) {
     RMW_SET_ERROR_MSG("failed to finalize datareader qos");
@@ -261,14 +563,63 @@ rmw_create_subscription(
     goto fail;
   }
 
+  subscriber_info->conflate = _use_conflation(subscription_options);
+
+  subscriber_info->ignore_local_publications = subscription_options->ignore_local_publications;
+  if (subscriber_info->ignore_local_publications) {
+    // Entities of a participant share its GUID prefix
+    uint8_t reader_guid[16];
+    ret = dds_DataReader_get_guid(topic_reader, reader_guid);
+    if (ret != dds_RETCODE_OK) {
+      RMW_SET_ERROR_MSG("failed to get datareader guid");
+      goto fail;
+    }
+    memcpy(
+      subscriber_info->participant_guid_prefix, reader_guid,
+      sizeof(subscriber_info->participant_guid_prefix));
+  }
+
+  // Samples are kept in the reader history in direct-take mode
+  if (!direct_take && !subscriber_info->conflate &&
+    !subscriber_info->message_queue.init(queue_capacity))
+  {
+    RMW_SET_ERROR_MSG("failed to allocate message queue");
+    goto fail;
+  }
+
   subscriber_info->implementation_identifier = gurum_gurumdds_identifier;
   subscriber_info->subscriber = dds_subscriber;
   subscriber_info->topic_reader = topic_reader;
+  subscriber_info->topic = topic;
+  subscriber_info->content_filtered_topic = content_filtered_topic;
+  subscriber_info->content_filter = content_filter;
+  if (content_filtered_topic == nullptr) {
+    subscriber_info->reader_content_filter = content_filter;
+  }
   subscriber_info->queue_guard_condition = queue_guard_condition;
+  subscriber_info->reader_seqs.max_samples = max_samples_per_callback;
+  subscriber_info->queue_byte_budget = _get_queue_byte_budget(subscription_options);
+  subscriber_info->queue_drop_newest = _use_queue_drop_newest(subscription_options);
+  subscriber_info->minimum_separation = _get_minimum_separation(subscription_options);
+  subscriber_info->read_condition = read_condition;
   subscriber_info->dds_typesupport = dds_typesupport;
   subscriber_info->rosidl_message_typesupport = type_support;
+  subscriber_info->message_pool.reset(new(std::nothrow) MessagePool(type_support));
+  if (subscriber_info->message_pool == nullptr) {
+    RMW_SET_ERROR_MSG("failed to allocate message pool");
+    goto fail;
+  }
+  // Other takes would deserialize the sample again, so messages are only
+  // prepared when loaned takes hand them over or they can be swapped in
+  if (_use_loaned_messages(subscription_options) ||
+    subscriber_info->message_pool->can_swap_prepared())
+  {
+    subscriber_info->message_pool->set_prepared_limit(
+      _get_pre_deserialize_depth(subscription_options));
+  }
 
   dds_DataReader_set_listener_context(subscriber_info->topic_reader, subscriber_info);
+  seed_publisher_gid_cache(subscriber_info);
 
   subscription = rmw_subscription_allocate();
   if (subscription == nullptr) {
@@ -285,7 +636,9 @@ rmw_create_subscription(
   }
   memcpy(const_cast<char *>(subscription->topic_name), topic_name, strlen(topic_name) + 1);
   subscription->options = *subscription_options;
-  subscription->can_loan_messages = false;
+  subscription->can_loan_messages =
+    _use_loaned_messages(subscription_options) && subscriber_info->message_pool->is_supported();
+  subscription->is_cft_enabled = content_filter != nullptr;
 
   rmw_ret = rmw_trigger_guard_condition(node_info->graph_guard_condition);
   if (rmw_ret != RMW_RET_OK) {
@@ -316,16 +669,25 @@ fail:
       if (queue_guard_condition != nullptr) {
         dds_GuardCondition_delete(queue_guard_condition);
       }
+      if (read_condition != nullptr) {
+        dds_DataReader_delete_readcondition(topic_reader, read_condition);
+      }
       dds_Subscriber_delete_datareader(dds_subscriber, topic_reader);
     }
     dds_DomainParticipant_delete_subscriber(participant, dds_subscriber);
   }
 
+  if (content_filtered_topic != nullptr) {
+    dds_DomainParticipant_delete_contentfilteredtopic(participant, content_filtered_topic);
+  }
+
   if (dds_typesupport != nullptr) {
     dds_TypeSupport_delete(dds_typesupport);
   }
 
   if (subscriber_info != nullptr) {
+    message_queue_clear(subscriber_info->message_queue);
+    conflated_message_clear(subscriber_info);
     delete subscriber_info;
   }
 
@@ -478,6 +840,139 @@ rmw_subscription_get_actual_qos(
   return RMW_RET_OK;
 }
 
+rmw_ret_t
+rmw_subscription_set_content_filter(
+  rmw_subscription_t * subscription,
+  const rmw_subscription_content_filter_options_t * options)
+{
+  RMW_CHECK_ARGUMENT_FOR_NULL(subscription, RMW_RET_INVALID_ARGUMENT);
+  RMW_CHECK_ARGUMENT_FOR_NULL(options, RMW_RET_INVALID_ARGUMENT);
+  RMW_CHECK_TYPE_IDENTIFIERS_MATCH(
+    subscription handle,
+    subscription->implementation_identifier,
+    gurum_gurumdds_identifier,
+    return RMW_RET_INCORRECT_RMW_IMPLEMENTATION)
+
+  auto info = static_cast<GurumddsSubscriberInfo *>(subscription->data);
+  if (info == nullptr || info->topic_reader == nullptr) {
+    RMW_SET_ERROR_MSG("subscription internal data is invalid");
+    return RMW_RET_ERROR;
+  }
+
+  std::shared_ptr<ContentFilter> content_filter;
+  rmw_ret_t rmw_ret = _compile_content_filter(
+    info->rosidl_message_typesupport, options, content_filter);
+  if (rmw_ret != RMW_RET_OK) {
+    // Error message already set
+    return rmw_ret;
+  }
+
+  // The reader is never recreated, since takes, waits and status queries use
+  // it without a lock. Without a ContentFilteredTopic the new filter is simply
+  // evaluated on the reader side. With one, DDS keeps filtering with the
+  // expression the subscription was created with, so only its parameters can change.
+  if (info->content_filtered_topic != nullptr) {
+    auto current_filter = std::atomic_load(&info->content_filter);
+    if (content_filter == nullptr || current_filter == nullptr ||
+      content_filter->get_expression() != current_filter->get_expression())
+    {
+      RMW_SET_ERROR_MSG(
+        "only the expression parameters of a subscription filtered by DDS can be changed");
+      return RMW_RET_UNSUPPORTED;
+    }
+
+    dds_StringSeq * dds_parameters = _create_expression_parameters(options);
+    if (dds_parameters == nullptr) {
+      RMW_SET_ERROR_MSG("failed to create expression parameter sequence");
+      return RMW_RET_ERROR;
+    }
+    dds_ReturnCode_t ret = dds_ContentFilteredTopic_set_expression_parameters(
+      info->content_filtered_topic, dds_parameters);
+    dds_StringSeq_delete(dds_parameters);
+    if (ret != dds_RETCODE_OK) {
+      RMW_SET_ERROR_MSG("failed to set expression parameters");
+      return RMW_RET_ERROR;
+    }
+  } else {
+    std::atomic_store(&info->reader_content_filter, content_filter);
+  }
+
+  std::atomic_store(&info->content_filter, content_filter);
+  subscription->is_cft_enabled = content_filter != nullptr;
+
+  return RMW_RET_OK;
+}
+
+rmw_ret_t
+rmw_subscription_get_content_filter(
+  const rmw_subscription_t * subscription,
+  rcutils_allocator_t * allocator,
+  rmw_subscription_content_filter_options_t * options)
+{
+  RMW_CHECK_ARGUMENT_FOR_NULL(subscription, RMW_RET_INVALID_ARGUMENT);
+  RMW_CHECK_ARGUMENT_FOR_NULL(allocator, RMW_RET_INVALID_ARGUMENT);
+  RMW_CHECK_ARGUMENT_FOR_NULL(options, RMW_RET_INVALID_ARGUMENT);
+  RMW_CHECK_TYPE_IDENTIFIERS_MATCH(
+    subscription handle,
+    subscription->implementation_identifier,
+    gurum_gurumdds_identifier,
+    return RMW_RET_INCORRECT_RMW_IMPLEMENTATION)
+
+  auto info = static_cast<GurumddsSubscriberInfo *>(subscription->data);
+  if (info == nullptr) {
+    RMW_SET_ERROR_MSG("subscription internal data is invalid");
+    return RMW_RET_ERROR;
+  }
+
+  // Held until the options are copied, in case the filter is replaced meanwhile
+  std::shared_ptr<ContentFilter> content_filter = std::atomic_load(&info->content_filter);
+  if (content_filter == nullptr) {
+    RMW_SET_ERROR_MSG("subscription has no content filter");
+    return RMW_RET_ERROR;
+  }
+
+  std::vector<const char *> parameters;
+  for (auto & parameter : content_filter->get_parameters()) {
+    parameters.push_back(parameter.c_str());
+  }
+
+  return rmw_subscription_content_filter_options_init(
+    content_filter->get_expression().c_str(),
+    parameters.size(),
+    parameters.data(),
+    allocator,
+    options);
+}
+
+rmw_ret_t
+rmw_subscription_set_on_new_message_callback(
+  rmw_subscription_t * subscription,
+  rmw_event_callback_t callback,
+  const void * user_data)
+{
+  RMW_CHECK_ARGUMENT_FOR_NULL(subscription, RMW_RET_INVALID_ARGUMENT);
+  RMW_CHECK_TYPE_IDENTIFIERS_MATCH(
+    subscription handle,
+    subscription->implementation_identifier,
+    gurum_gurumdds_identifier,
+    return RMW_RET_INCORRECT_RMW_IMPLEMENTATION)
+
+  auto info = static_cast<GurumddsSubscriberInfo *>(subscription->data);
+  if (info == nullptr) {
+    RMW_SET_ERROR_MSG("subscription internal data is invalid");
+    return RMW_RET_ERROR;
+  }
+
+  // Samples stay in the reader until taken, so the listener never counts them
+  if (info->read_condition != nullptr) {
+    RMW_SET_ERROR_MSG("new message callbacks are not supported in direct-take mode");
+    return RMW_RET_UNSUPPORTED;
+  }
+
+  info->new_message_callback.set(callback, user_data);
+  return RMW_RET_OK;
+}
+
 rmw_ret_t
 rmw_destroy_subscription(rmw_node_t * node, rmw_subscription_t * subscription)
 {
@@ -520,6 +1015,19 @@ rmw_destroy_subscription(rmw_node_t * node, rmw_subscription_t * subscription)
     if (dds_subscriber != nullptr) {
       dds_DataReader * topic_reader = subscriber_info->topic_reader;
       if (topic_reader != nullptr) {
+        shared__rmw_wait_set_forget_condition(
+          reinterpret_cast<dds_Condition *>(dds_DataReader_get_statuscondition(topic_reader)));
+        if (subscriber_info->read_condition != nullptr) {
+          shared__rmw_wait_set_forget_condition(
+            reinterpret_cast<dds_Condition *>(subscriber_info->read_condition));
+          ret = dds_DataReader_delete_readcondition(topic_reader, subscriber_info->read_condition);
+          if (ret != dds_RETCODE_OK) {
+            RMW_SET_ERROR_MSG("failed to delete readcondition");
+            rmw_ret = RMW_RET_ERROR;
+          }
+          subscriber_info->read_condition = nullptr;
+        }
+
         ret = dds_Subscriber_delete_datareader(dds_subscriber, topic_reader);
         if (ret != dds_RETCODE_OK) {
           RMW_SET_ERROR_MSG("failed to delete datareader");
@@ -538,21 +1046,25 @@ rmw_destroy_subscription(rmw_node_t * node, rmw_subscription_t * subscription)
       rmw_ret = RMW_RET_ERROR;
     }
 
+    if (subscriber_info->content_filtered_topic != nullptr) {
+      ret = dds_DomainParticipant_delete_contentfilteredtopic(
+        participant, subscriber_info->content_filtered_topic);
+      if (ret != dds_RETCODE_OK) {
+        RMW_SET_ERROR_MSG("failed to delete content filtered topic");
+        rmw_ret = RMW_RET_ERROR;
+      }
+      subscriber_info->content_filtered_topic = nullptr;
+    }
+
     if (subscriber_info->queue_guard_condition != nullptr) {
+      shared__rmw_wait_set_forget_condition(
+        reinterpret_cast<dds_Condition *>(subscriber_info->queue_guard_condition));
       dds_GuardCondition_delete(subscriber_info->queue_guard_condition);
       subscriber_info->queue_guard_condition = nullptr;
     }
 
-    while (!subscriber_info->message_queue.empty()) {
-      auto msg = subscriber_info->message_queue.front();
-      if (msg.sample != nullptr) {
-        dds_free(msg.sample);
-      }
-      if (msg.info != nullptr) {
-        dds_free(msg.info);
-      }
-      subscriber_info->message_queue.pop();
-    }
+    message_queue_clear(subscriber_info->message_queue);
+    conflated_message_clear(subscriber_info);
 
     if (subscriber_info->dds_typesupport != nullptr) {
       dds_TypeSupport_delete(subscriber_info->dds_typesupport);
@@ -579,11 +1091,192 @@ rmw_destroy_subscription(rmw_node_t * node, rmw_subscription_t * subscription)
   return rmw_ret;
 }
 
+static rmw_ret_t
+_raw_take_one(GurumddsSubscriberInfo * info, GurumddsMessage * msg, bool * taken)
+{
+  *taken = false;
+
+  // The listener is not installed in direct-take mode, so these are only shared between takes
+  GurumddsReaderSeqs & seqs = info->reader_seqs;
+  std::lock_guard<std::mutex> lock(seqs.mutex);
+  if (!seqs.prepare()) {
+    RMW_SET_ERROR_MSG("failed to create sample sequences");
+    return RMW_RET_ERROR;
+  }
+
+  rmw_ret_t rmw_ret = RMW_RET_OK;
+  dds_ReturnCode_t ret = dds_DataReader_raw_take(
+    info->topic_reader, dds_HANDLE_NIL, seqs.samples, seqs.infos, seqs.sizes, 1,
+    dds_ANY_SAMPLE_STATE, dds_ANY_VIEW_STATE, dds_ANY_INSTANCE_STATE);
+  if (ret == dds_RETCODE_OK && dds_DataSeq_length(seqs.samples) > 0) {
+    // The sample is released by the caller
+    msg->sample = dds_DataSeq_get(seqs.samples, 0);
+    msg->info = dds_SampleInfoSeq_get(seqs.infos, 0);
+    msg->size = dds_UnsignedLongSeq_get(seqs.sizes, 0);
+    msg->received_timestamp = 0;
+    rcutils_system_time_now(&msg->received_timestamp);
+    msg->ros_message = nullptr;
+    msg->ros_message_owner = nullptr;
+    *taken = true;
+  } else if (ret != dds_RETCODE_OK && ret != dds_RETCODE_NO_DATA) {
+    RMW_SET_ERROR_MSG("failed to take data");
+    rmw_ret = RMW_RET_ERROR;
+  }
+
+  seqs.reset();
+
+  return rmw_ret;
+}
+
+// Takes the next sample from the message queue, from the newest samples
+// in conflation mode, or from the reader itself in direct-take mode
+static rmw_ret_t
+_take_message(GurumddsSubscriberInfo * info, GurumddsMessage * msg, bool * taken)
+{
+  if (info->conflate) {
+    *taken = conflated_message_pop(info, msg);
+    return RMW_RET_OK;
+  }
+
+  if (info->read_condition == nullptr) {
+    *taken = queued_message_pop(info, msg);
+    return RMW_RET_OK;
+  }
+
+  for (;;) {
+    rmw_ret_t rmw_ret = _raw_take_one(info, msg, taken);
+    if (rmw_ret != RMW_RET_OK || !*taken) {
+      return rmw_ret;
+    }
+
+    if (reader_accept_sample(info, *msg)) {
+      msg->reception_sequence_number = ++info->reader_seqs.reception_count;
+      return RMW_RET_OK;
+    }
+    message_queue_free(*msg);
+  }
+}
+
+static void
+_free_messages(std::vector<GurumddsMessage> & messages)
+{
+  for (auto & msg : messages) {
+    message_queue_free(msg);
+  }
+  messages.clear();
+}
+
+// Batches smaller than this are deserialized on the calling thread
+static const size_t PARALLEL_TAKE_MIN_BATCH = 8;
+
+// Deserializes large rmw_take_sequence() batches in parallel.
+// RMW_GURUMDDS_TAKE_THREADS sets the number of worker threads; there are none by default.
+static WorkerPool *
+_get_take_worker_pool()
+{
+  static std::unique_ptr<WorkerPool> worker_pool = []() {
+      const char * env_value = getenv("RMW_GURUMDDS_TAKE_THREADS");
+      unsigned long thread_count = 0;  // NOLINT
+      if (env_value != nullptr) {
+        thread_count = strtoul(env_value, nullptr, 10);
+      }
+      std::unique_ptr<WorkerPool> pool;
+      if (thread_count > 0 && thread_count <= 256) {
+        try {
+          pool.reset(new(std::nothrow) WorkerPool(thread_count));
+        } catch (const std::system_error &) {
+          // Batches are deserialized on the calling thread without a pool
+          RCUTILS_LOG_WARN_NAMED(
+            "rmw_gurumdds_cpp", "failed to create take worker threads, taking sequentially");
+        }
+      }
+      return pool;
+    }();
+  return worker_pool.get();
+}
+
+static void
+_fill_message_info(
+  const char * identifier,
+  GurumddsSubscriberInfo * info,
+  const GurumddsMessage & msg,
+  rmw_message_info_t * message_info)
+{
+  message_info->source_timestamp =
+    msg.info->source_timestamp.sec * static_cast<int64_t>(1000000000) +
+    msg.info->source_timestamp.nanosec;
+  message_info->received_timestamp = msg.received_timestamp;
+  // SampleInfo does not carry the writer sequence number
+  message_info->publication_sequence_number = RMW_MESSAGE_INFO_SEQUENCE_NUMBER_UNSUPPORTED;
+  message_info->reception_sequence_number = msg.reception_sequence_number;
+  rmw_gid_t * sender_gid = &message_info->publisher_gid;
+  sender_gid->implementation_identifier = identifier;
+  memset(sender_gid->data, 0, RMW_GID_STORAGE_SIZE);
+  auto custom_gid = reinterpret_cast<GurumddsPublisherGID *>(sender_gid->data);
+  get_publisher_gid(info, msg.info->publication_handle, custom_gid);
+}
+
+// Deserializes the message into ros_message, or into a pooled message loaned
+// to the caller when loaned_message is set. A message deserialized on arrival
+// is handed over instead when possible.
+static rmw_ret_t
+_deliver_message(
+  GurumddsSubscriberInfo * info,
+  GurumddsMessage * msg,
+  void * ros_message,
+  void ** loaned_message)
+{
+  MessagePool * message_pool = info->message_pool.get();
+  if (msg->ros_message != nullptr) {
+    if (loaned_message != nullptr) {
+      message_pool->claim_prepared(msg->ros_message);
+      *loaned_message = msg->ros_message;
+      msg->ros_message = nullptr;
+      return RMW_RET_OK;
+    }
+    if (message_pool->swap_prepared(msg->ros_message, ros_message)) {
+      msg->ros_message = nullptr;
+      return RMW_RET_OK;
+    }
+    // The prepared message is released along with the sample
+  }
+
+  if (loaned_message != nullptr) {
+    // Messages are deserialized into a pool slot that stays loaned until it is returned
+    ros_message = message_pool->borrow();
+    if (ros_message == nullptr) {
+      // Error message already set
+      return RMW_RET_BAD_ALLOC;
+    }
+  }
+
+  bool result = deserialize_cdr_to_ros(
+    info->rosidl_message_typesupport->data,
+    info->rosidl_message_typesupport->typesupport_identifier,
+    ros_message,
+    msg->sample,
+    static_cast<size_t>(msg->size)
+  );
+  if (!result) {
+    RMW_SET_ERROR_MSG("Failed to deserialize message");
+    if (loaned_message != nullptr) {
+      message_pool->give_back(ros_message);
+    }
+    return RMW_RET_ERROR;
+  }
+
+  if (loaned_message != nullptr) {
+    *loaned_message = ros_message;
+  }
+  return RMW_RET_OK;
+}
+
 static rmw_ret_t
 _take(
   const char * identifier,
   const rmw_subscription_t * subscription,
   void * ros_message,
+  void ** loaned_message,
   bool * taken,
   rmw_message_info_t * message_info,
   rmw_subscription_allocation_t * allocation)
@@ -602,17 +1295,15 @@ _take(
   dds_DataReader * topic_reader = info->topic_reader;
   RCUTILS_CHECK_FOR_NULL_WITH_MSG(topic_reader, "topic reader is null", return RMW_RET_ERROR);
 
-  if (info->message_queue.empty()) {
-    return RMW_RET_OK;
-  }
+  // Messages are prepared for deserializing takes from now on
+  info->deserializing_takes.store(true, std::memory_order_relaxed);
 
-  info->queue_mutex.lock();
-  auto msg = info->message_queue.front();
-  info->message_queue.pop();
-  if (info->message_queue.empty()) {
-    dds_GuardCondition_set_trigger_value(info->queue_guard_condition, false);
+  GurumddsMessage msg;
+  bool has_message = false;
+  rmw_ret_t rmw_ret = _take_message(info, &msg, &has_message);
+  if (rmw_ret != RMW_RET_OK || !has_message) {
+    return rmw_ret;
   }
-  info->queue_mutex.unlock();
 
   bool ignore_sample = false;
 
@@ -623,54 +1314,50 @@ _take(
   if (!ignore_sample) {
     if (msg.sample == nullptr) {
       RMW_SET_ERROR_MSG("Received invalid message");
-      dds_free(msg.info);
+      message_queue_free(msg);
       return RMW_RET_ERROR;
     }
-    bool result = deserialize_cdr_to_ros(
-      info->rosidl_message_typesupport->data,
-      info->rosidl_message_typesupport->typesupport_identifier,
-      ros_message,
-      msg.sample,
-      static_cast<size_t>(msg.size)
-    );
-    if (!result) {
-      RMW_SET_ERROR_MSG("Failed to deserialize message");
-      dds_free(msg.sample);
-      dds_free(msg.info);
-      return RMW_RET_ERROR;
+    rmw_ret = _deliver_message(info, &msg, ros_message, loaned_message);
+    if (rmw_ret != RMW_RET_OK) {
+      message_queue_free(msg);
+      return rmw_ret;
     }
 
     *taken = true;
 
     if (message_info != nullptr) {
-      message_info->source_timestamp =
-        msg.info->source_timestamp.sec * static_cast<int64_t>(1000000000) +
-        msg.info->source_timestamp.nanosec;
-      // TODO(clemjh): SampleInfo doesn't contain received_timestamp
-      message_info->received_timestamp = 0;
-      rmw_gid_t * sender_gid = &message_info->publisher_gid;
-      sender_gid->implementation_identifier = identifier;
-      memset(sender_gid->data, 0, RMW_GID_STORAGE_SIZE);
-      auto custom_gid = reinterpret_cast<GurumddsPublisherGID *>(sender_gid->data);
-      dds_ReturnCode_t ret = dds_DataReader_get_guid_from_publication_handle(
-        topic_reader, msg.info->publication_handle, custom_gid->publication_handle);
-      if (ret != dds_RETCODE_OK) {
-        if (ret == dds_RETCODE_ERROR) {
-          RCUTILS_LOG_WARN_NAMED("rmw_gurumdds_cpp", "Failed to get publication handle");
-        }
-        memset(custom_gid->publication_handle, 0, sizeof(custom_gid->publication_handle));
-      }
+      _fill_message_info(identifier, info, msg, message_info);
     }
   }
 
-  if (msg.sample != nullptr) {
-    dds_free(msg.sample);
+  message_queue_free(msg);
+
+  return RMW_RET_OK;
+}
+
+static rmw_ret_t
+_take_loaned(
+  const char * identifier,
+  const rmw_subscription_t * subscription,
+  void ** loaned_message,
+  bool * taken,
+  rmw_message_info_t * message_info,
+  rmw_subscription_allocation_t * allocation)
+{
+  *taken = false;
+
+  if (subscription->implementation_identifier != identifier) {
+    RMW_SET_ERROR_MSG("subscription handle not from this implementation");
+    return RMW_RET_INCORRECT_RMW_IMPLEMENTATION;
   }
-  if (msg.info != nullptr) {
-    dds_free(msg.info);
+
+  if (!subscription->can_loan_messages) {
+    RMW_SET_ERROR_MSG("subscription does not loan messages");
+    return RMW_RET_UNSUPPORTED;
   }
 
-  return RMW_RET_OK;
+  return _take(
+    identifier, subscription, nullptr, loaned_message, taken, message_info, allocation);
 }
 
 rmw_ret_t
@@ -688,7 +1375,7 @@ rmw_take(
     taken, "boolean flag for taken is null", return RMW_RET_ERROR);
 
   return _take(
-    gurum_gurumdds_identifier, subscription, ros_message, taken, nullptr, allocation);
+    gurum_gurumdds_identifier, subscription, ros_message, nullptr, taken, nullptr, allocation);
 }
 
 rmw_ret_t
@@ -709,7 +1396,7 @@ rmw_take_with_info(
     message_info, "message info pointer is null", return RMW_RET_ERROR);
 
   return _take(
-    gurum_gurumdds_identifier, subscription, ros_message, taken, message_info, allocation);
+    gurum_gurumdds_identifier, subscription, ros_message, nullptr, taken, message_info, allocation);
 }
 
 rmw_ret_t
@@ -758,80 +1445,85 @@ rmw_take_sequence(
   dds_DataReader * topic_reader = info->topic_reader;
   RCUTILS_CHECK_FOR_NULL_WITH_MSG(topic_reader, "topic reader is null", return RMW_RET_ERROR);
 
-  if (info->message_queue.empty()) {
-    return RMW_RET_OK;
-  }
+  // Messages are prepared for deserializing takes from now on
+  info->deserializing_takes.store(true, std::memory_order_relaxed);
 
   *taken = 0;
-  size_t attempt = 0;
-
-  info->queue_mutex.lock();
-  while (attempt < count && !info->message_queue.empty()) {
-    auto msg = info->message_queue.front();
-    info->message_queue.pop();
-    if (info->message_queue.empty()) {
-      dds_GuardCondition_set_trigger_value(info->queue_guard_condition, false);
+  std::vector<GurumddsMessage> batch;
+  batch.reserve(count);
+  for (size_t attempt = 0; attempt < count; attempt++) {
+    GurumddsMessage msg;
+    bool has_message = false;
+    rmw_ret_t rmw_ret = _take_message(info, &msg, &has_message);
+    if (rmw_ret != RMW_RET_OK) {
+      _free_messages(batch);
+      return rmw_ret;
+    }
+    if (!has_message) {
+      break;
     }
-    bool ignore_sample = false;
-    attempt++;
 
     if (!msg.info->valid_data) {
-      ignore_sample = true;
+      message_queue_free(msg);
+      continue;
     }
 
-    if (!ignore_sample) {
-      if (msg.sample == nullptr) {
-        RMW_SET_ERROR_MSG("Received invalid message");
-        dds_free(msg.info);
-        return RMW_RET_ERROR;
+    if (msg.sample == nullptr) {
+      RMW_SET_ERROR_MSG("Received invalid message");
+      message_queue_free(msg);
+      _free_messages(batch);
+      return RMW_RET_ERROR;
+    }
+    batch.push_back(msg);
+  }
+
+  // The batch is off the queue, so the listener keeps queueing while it is deserialized
+  std::unique_ptr<bool[]> deserialized(new bool[batch.size()]);
+  auto deserialize = [&](size_t i) {
+      if (batch[i].ros_message != nullptr &&
+        info->message_pool->swap_prepared(batch[i].ros_message, message_sequence->data[i]))
+      {
+        batch[i].ros_message = nullptr;
+        deserialized[i] = true;
+        return;
       }
-      bool result = deserialize_cdr_to_ros(
+      deserialized[i] = deserialize_cdr_to_ros(
         info->rosidl_message_typesupport->data,
         info->rosidl_message_typesupport->typesupport_identifier,
-        message_sequence->data[*taken],
-        msg.sample,
-        static_cast<size_t>(msg.size)
-      );
-      if (!result) {
-        RMW_SET_ERROR_MSG("Failed to deserialize message");
-        dds_free(msg.sample);
-        dds_free(msg.info);
-        return RMW_RET_ERROR;
-      }
-
-      auto message_info = &(message_info_sequence->data[*taken]);
-
-      message_info->source_timestamp =
-        msg.info->source_timestamp.sec * static_cast<int64_t>(1000000000) +
-        msg.info->source_timestamp.nanosec;
-      // TODO(clemjh): SampleInfo doesn't contain received_timestamp
-      message_info->received_timestamp = 0;
-      rmw_gid_t * sender_gid = &message_info->publisher_gid;
-      sender_gid->implementation_identifier = gurum_gurumdds_identifier;
-      memset(sender_gid->data, 0, RMW_GID_STORAGE_SIZE);
-      auto custom_gid = reinterpret_cast<GurumddsPublisherGID *>(sender_gid->data);
-      dds_ReturnCode_t ret = dds_DataReader_get_guid_from_publication_handle(
-        topic_reader, msg.info->publication_handle, custom_gid->publication_handle);
-      if (ret != dds_RETCODE_OK) {
-        if (ret == dds_RETCODE_ERROR) {
-          RCUTILS_LOG_WARN_NAMED("rmw_gurumdds_cpp", "Failed to get publication handle");
-        }
-        memset(custom_gid->publication_handle, 0, sizeof(custom_gid->publication_handle));
-      }
-
-      (*taken)++;
+        message_sequence->data[i],
+        batch[i].sample,
+        static_cast<size_t>(batch[i].size));
+    };
+
+  // A pool busy with another subscription's batch leaves this one to the calling thread
+  WorkerPool * worker_pool = _get_take_worker_pool();
+  if (worker_pool == nullptr || batch.size() < PARALLEL_TAKE_MIN_BATCH ||
+    !worker_pool->parallel_for(batch.size(), deserialize))
+  {
+    for (size_t i = 0; i < batch.size(); i++) {
+      deserialize(i);
     }
+  }
 
-    if (msg.sample != nullptr) {
-      dds_free(msg.sample);
+  // The batch is already off the queue, so a sample that fails to deserialize
+  // is dropped on its own and the rest of the batch is still returned
+  size_t kept = 0;
+  for (size_t i = 0; i < batch.size(); i++) {
+    if (!deserialized[i]) {
+      RCUTILS_LOG_WARN_NAMED(
+        "rmw_gurumdds_cpp", "failed to deserialize a taken message, dropping it");
+      continue;
     }
-    if (msg.info != nullptr) {
-      dds_free(msg.info);
+    if (kept != i) {
+      std::swap(message_sequence->data[kept], message_sequence->data[i]);
+      std::swap(batch[kept], batch[i]);
     }
+    _fill_message_info(
+      gurum_gurumdds_identifier, info, batch[kept], &message_info_sequence->data[kept]);
+    kept++;
   }
-  info->queue_mutex.unlock();
-
-  // =============================================================================================
+  *taken = kept;
+  _free_messages(batch);
 
   message_sequence->size = *taken;
   message_info_sequence->size = *taken;
@@ -839,6 +1531,36 @@ rmw_take_sequence(
   return RMW_RET_OK;
 }
 
+// Moves the sample into messages using the sample buffer allocator and copies it
+// into any other. msg->sample is set to null when it was moved.
+static rmw_ret_t
+_fill_serialized_message(rmw_serialized_message_t * serialized_message, GurumddsMessage * msg)
+{
+  if (serialized_message->allocator.deallocate == _sample_buffer_deallocate) {
+    // Hand the sample over instead of copying it
+    if (serialized_message->buffer != nullptr) {
+      dds_free(serialized_message->buffer);
+    }
+    serialized_message->buffer = static_cast<uint8_t *>(msg->sample);
+    serialized_message->buffer_length = msg->size;
+    serialized_message->buffer_capacity = msg->size;
+    msg->sample = nullptr;
+    return RMW_RET_OK;
+  }
+
+  serialized_message->buffer_length = msg->size;
+  if (serialized_message->buffer_capacity < msg->size) {
+    rmw_ret_t rmw_ret = rmw_serialized_message_resize(serialized_message, msg->size);
+    if (rmw_ret != RMW_RET_OK) {
+      // Error message already set
+      return rmw_ret;
+    }
+  }
+
+  memcpy(serialized_message->buffer, msg->sample, msg->size);
+  return RMW_RET_OK;
+}
+
 static rmw_ret_t
 _take_serialized(
   const char * identifier,
@@ -862,18 +1584,13 @@ _take_serialized(
   dds_DataReader * topic_reader = info->topic_reader;
   RCUTILS_CHECK_FOR_NULL_WITH_MSG(topic_reader, "topic reader is null", return RMW_RET_ERROR);
 
-  if (info->message_queue.empty()) {
-    return RMW_RET_OK;
+  GurumddsMessage msg;
+  bool has_message = false;
+  rmw_ret_t rmw_ret = _take_message(info, &msg, &has_message);
+  if (rmw_ret != RMW_RET_OK || !has_message) {
+    return rmw_ret;
   }
 
-  info->queue_mutex.lock();
-  auto msg = info->message_queue.front();
-  info->message_queue.pop();
-  if (info->message_queue.empty()) {
-    dds_GuardCondition_set_trigger_value(info->queue_guard_condition, false);
-  }
-  info->queue_mutex.unlock();
-
   bool ignore_sample = false;
 
   if (!msg.info->valid_data) {
@@ -883,52 +1600,25 @@ _take_serialized(
   if (!ignore_sample) {
     if (msg.sample == nullptr) {
       RMW_SET_ERROR_MSG("Received invalid message");
-      dds_free(msg.info);
+      message_queue_free(msg);
       return RMW_RET_ERROR;
     }
 
-    serialized_message->buffer_length = msg.size;
-    if (serialized_message->buffer_capacity < msg.size) {
-      rmw_ret_t rmw_ret = rmw_serialized_message_resize(serialized_message, msg.size);
-      if (rmw_ret != RMW_RET_OK) {
-        // Error message already set
-        dds_free(msg.sample);
-        dds_free(msg.info);
-        return rmw_ret;
-      }
+    rmw_ret = _fill_serialized_message(serialized_message, &msg);
+    if (rmw_ret != RMW_RET_OK) {
+      // Error message already set
+      message_queue_free(msg);
+      return rmw_ret;
     }
 
-    memcpy(serialized_message->buffer, msg.sample, msg.size);
-
     *taken = true;
 
     if (message_info != nullptr) {
-      message_info->source_timestamp =
-        msg.info->source_timestamp.sec * static_cast<int64_t>(1000000000) +
-        msg.info->source_timestamp.nanosec;
-      // TODO(clemjh): SampleInfo doesn't contain received_timestamp
-      message_info->received_timestamp = 0;
-      rmw_gid_t * sender_gid = &message_info->publisher_gid;
-      sender_gid->implementation_identifier = identifier;
-      memset(sender_gid->data, 0, RMW_GID_STORAGE_SIZE);
-      auto custom_gid = reinterpret_cast<GurumddsPublisherGID *>(sender_gid->data);
-      dds_ReturnCode_t ret = dds_DataReader_get_guid_from_publication_handle(
-        topic_reader, msg.info->publication_handle, custom_gid->publication_handle);
-      if (ret != dds_RETCODE_OK) {
-        if (ret == dds_RETCODE_ERROR) {
-          RCUTILS_LOG_WARN_NAMED("rmw_gurumdds_cpp", "Failed to get publication handle");
-        }
-        memset(custom_gid->publication_handle, 0, sizeof(custom_gid->publication_handle));
-      }
+      _fill_message_info(identifier, info, msg, message_info);
     }
   }
 
-  if (msg.sample != nullptr) {
-    dds_free(msg.sample);
-  }
-  if (msg.info != nullptr) {
-    dds_free(msg.info);
-  }
+  message_queue_free(msg);
 
   return RMW_RET_OK;
 }
@@ -981,13 +1671,15 @@ rmw_take_loaned_message(
   bool * taken,
   rmw_subscription_allocation_t * allocation)
 {
-  (void)subscription;
-  (void)loaned_message;
-  (void)taken;
-  (void)allocation;
+  RCUTILS_CHECK_FOR_NULL_WITH_MSG(
+    subscription, "subscription pointer is null", return RMW_RET_INVALID_ARGUMENT);
+  RCUTILS_CHECK_FOR_NULL_WITH_MSG(
+    loaned_message, "loaned message pointer is null", return RMW_RET_INVALID_ARGUMENT);
+  RCUTILS_CHECK_FOR_NULL_WITH_MSG(
+    taken, "boolean flag for taken is null", return RMW_RET_INVALID_ARGUMENT);
 
-  RMW_SET_ERROR_MSG("rmw_take_loaned_message is not supported");
-  return RMW_RET_UNSUPPORTED;
+  return _take_loaned(
+    gurum_gurumdds_identifier, subscription, loaned_message, taken, nullptr, allocation);
 }
 
 rmw_ret_t
@@ -998,14 +1690,17 @@ rmw_take_loaned_message_with_info(
   rmw_message_info_t * message_info,
   rmw_subscription_allocation_t * allocation)
 {
-  (void)subscription;
-  (void)loaned_message;
-  (void)taken;
-  (void)message_info;
-  (void)allocation;
+  RCUTILS_CHECK_FOR_NULL_WITH_MSG(
+    subscription, "subscription pointer is null", return RMW_RET_INVALID_ARGUMENT);
+  RCUTILS_CHECK_FOR_NULL_WITH_MSG(
+    loaned_message, "loaned message pointer is null", return RMW_RET_INVALID_ARGUMENT);
+  RCUTILS_CHECK_FOR_NULL_WITH_MSG(
+    taken, "boolean flag for taken is null", return RMW_RET_INVALID_ARGUMENT);
+  RCUTILS_CHECK_FOR_NULL_WITH_MSG(
+    message_info, "message info pointer is null", return RMW_RET_INVALID_ARGUMENT);
 
-  RMW_SET_ERROR_MSG("rmw_take_loaned_message_with_info is not supported");
-  return RMW_RET_UNSUPPORTED;
+  return _take_loaned(
+    gurum_gurumdds_identifier, subscription, loaned_message, taken, message_info, allocation);
 }
 
 rmw_ret_t
@@ -1013,10 +1708,145 @@ rmw_return_loaned_message_from_subscription(
   const rmw_subscription_t * subscription,
   void * loaned_message)
 {
-  (void)subscription;
-  (void)loaned_message;
+  RCUTILS_CHECK_FOR_NULL_WITH_MSG(
+    subscription, "subscription pointer is null", return RMW_RET_INVALID_ARGUMENT);
+  RCUTILS_CHECK_FOR_NULL_WITH_MSG(
+    loaned_message, "loaned message pointer is null", return RMW_RET_INVALID_ARGUMENT);
 
-  RMW_SET_ERROR_MSG("rmw_return_loaned_message_from_subscription is not supported");
-  return RMW_RET_UNSUPPORTED;
+  RMW_CHECK_TYPE_IDENTIFIERS_MATCH(
+    subscription handle,
+    subscription->implementation_identifier,
+    gurum_gurumdds_identifier,
+    return RMW_RET_INCORRECT_RMW_IMPLEMENTATION)
+
+  GurumddsSubscriberInfo * info = static_cast<GurumddsSubscriberInfo *>(subscription->data);
+  RCUTILS_CHECK_FOR_NULL_WITH_MSG(info, "custom subscriber info is null", return RMW_RET_ERROR);
+
+  if (!info->message_pool->give_back(loaned_message)) {
+    RMW_SET_ERROR_MSG("loaned message was not loaned by this subscription");
+    return RMW_RET_ERROR;
+  }
+
+  return RMW_RET_OK;
 }
 }  // extern "C"
+
+namespace rmw_gurumdds_cpp
+{
+rcutils_allocator_t
+get_sample_buffer_allocator()
+{
+  rcutils_allocator_t allocator = rcutils_get_zero_initialized_allocator();
+  allocator.allocate = _sample_buffer_allocate;
+  allocator.deallocate = _sample_buffer_deallocate;
+  allocator.reallocate = _sample_buffer_reallocate;
+  allocator.zero_allocate = _sample_buffer_zero_allocate;
+  return allocator;
+}
+
+rmw_ret_t
+take_serialized_sequence(
+  const rmw_subscription_t * subscription,
+  size_t count,
+  rmw_serialized_message_t * serialized_messages,
+  rmw_message_info_t * message_infos,
+  size_t * taken)
+{
+  RMW_CHECK_ARGUMENT_FOR_NULL(subscription, RMW_RET_INVALID_ARGUMENT);
+  RMW_CHECK_ARGUMENT_FOR_NULL(serialized_messages, RMW_RET_INVALID_ARGUMENT);
+  RMW_CHECK_ARGUMENT_FOR_NULL(taken, RMW_RET_INVALID_ARGUMENT);
+  RMW_CHECK_TYPE_IDENTIFIERS_MATCH(
+    subscription handle,
+    subscription->implementation_identifier, gurum_gurumdds_identifier,
+    return RMW_RET_INCORRECT_RMW_IMPLEMENTATION)
+
+  if (0u == count) {
+    RMW_SET_ERROR_MSG("count cannot be 0");
+    return RMW_RET_INVALID_ARGUMENT;
+  }
+
+  GurumddsSubscriberInfo * info = static_cast<GurumddsSubscriberInfo *>(subscription->data);
+  RCUTILS_CHECK_FOR_NULL_WITH_MSG(info, "custom subscriber info is null", return RMW_RET_ERROR);
+  RCUTILS_CHECK_FOR_NULL_WITH_MSG(
+    info->topic_reader, "topic reader is null", return RMW_RET_ERROR);
+
+  *taken = 0;
+  GurumddsMessage msg;
+  while (*taken < count) {
+    bool has_message = false;
+    rmw_ret_t rmw_ret = _take_message(info, &msg, &has_message);
+    if (rmw_ret != RMW_RET_OK) {
+      return rmw_ret;
+    }
+    if (!has_message) {
+      break;
+    }
+
+    if (msg.info->valid_data) {
+      if (msg.sample == nullptr) {
+        RMW_SET_ERROR_MSG("Received invalid message");
+        message_queue_free(msg);
+        return RMW_RET_ERROR;
+      }
+
+      rmw_ret = _fill_serialized_message(&serialized_messages[*taken], &msg);
+      if (rmw_ret != RMW_RET_OK) {
+        // Error message already set
+        message_queue_free(msg);
+        return rmw_ret;
+      }
+
+      if (message_infos != nullptr) {
+        _fill_message_info(gurum_gurumdds_identifier, info, msg, &message_infos[*taken]);
+      }
+
+      (*taken)++;
+    }
+
+    message_queue_free(msg);
+  }
+
+  return RMW_RET_OK;
+}
+
+rmw_ret_t
+get_subscription_queue_statistics(
+  const rmw_subscription_t * subscription,
+  SubscriptionQueueStatistics * statistics)
+{
+  RMW_CHECK_ARGUMENT_FOR_NULL(subscription, RMW_RET_INVALID_ARGUMENT);
+  RMW_CHECK_ARGUMENT_FOR_NULL(statistics, RMW_RET_INVALID_ARGUMENT);
+  RMW_CHECK_TYPE_IDENTIFIERS_MATCH(
+    subscription handle,
+    subscription->implementation_identifier, gurum_gurumdds_identifier,
+    return RMW_RET_INCORRECT_RMW_IMPLEMENTATION)
+
+  GurumddsSubscriberInfo * info = static_cast<GurumddsSubscriberInfo *>(subscription->data);
+  RCUTILS_CHECK_FOR_NULL_WITH_MSG(info, "custom subscriber info is null", return RMW_RET_ERROR);
+
+  statistics->queued_bytes = info->queued_bytes.load();
+  statistics->peak_queued_bytes = info->peak_queued_bytes.load();
+  statistics->budget_dropped_count = info->budget_dropped_count.load();
+  statistics->budget_dropped_bytes = info->budget_dropped_bytes.load();
+
+  return RMW_RET_OK;
+}
+
+rmw_ret_t
+get_subscription_time_filtered_count(const rmw_subscription_t * subscription, uint64_t * count)
+{
+  RMW_CHECK_ARGUMENT_FOR_NULL(subscription, RMW_RET_INVALID_ARGUMENT);
+  RMW_CHECK_ARGUMENT_FOR_NULL(count, RMW_RET_INVALID_ARGUMENT);
+  RMW_CHECK_TYPE_IDENTIFIERS_MATCH(
+    subscription handle,
+    subscription->implementation_identifier, gurum_gurumdds_identifier,
+    return RMW_RET_INCORRECT_RMW_IMPLEMENTATION)
+
+  GurumddsSubscriberInfo * info = static_cast<GurumddsSubscriberInfo *>(subscription->data);
+  RCUTILS_CHECK_FOR_NULL_WITH_MSG(info, "custom subscriber info is null", return RMW_RET_ERROR);
+
+  *count = info->time_filtered_count.load();
+
+  return RMW_RET_OK;
+}
+}  // namespace rmw_gurumdds_cpp
@@ -12,10 +12,133 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <cstring>
+#include <mutex>
+#include <unordered_set>
+
 #include "rmw_gurumdds_shared_cpp/event_converter.hpp"
 #include "rmw_gurumdds_shared_cpp/qos.hpp"
 #include "rmw_gurumdds_cpp/types.hpp"
 
+#include "./content_filter.hpp"
+#include "./message_pool.hpp"
+#include "./type_support_common.hpp"
+
+static const dds_StatusMask WRITER_EVENT_STATUSES =
+  dds_LIVELINESS_LOST_STATUS | dds_OFFERED_DEADLINE_MISSED_STATUS |
+  dds_OFFERED_INCOMPATIBLE_QOS_STATUS;
+
+static const dds_StatusMask READER_EVENT_STATUSES =
+  dds_LIVELINESS_CHANGED_STATUS | dds_REQUESTED_DEADLINE_MISSED_STATUS |
+  dds_REQUESTED_INCOMPATIBLE_QOS_STATUS | dds_SAMPLE_LOST_STATUS;
+
+// Statuses whose event callback is set
+static dds_StatusMask _get_event_listener_mask(GurumddsEventInfo * event_info)
+{
+  dds_StatusMask mask = 0;
+  for (int i = 0; i < RMW_EVENT_INVALID; i++) {
+    auto event_type = static_cast<rmw_event_type_t>(i);
+    if (is_event_supported(event_type) && event_info->event_callbacks[i].is_set()) {
+      mask |= get_status_kind_from_rmw(event_type);
+    }
+  }
+  return mask;
+}
+
+// Returns the status kind of the event, or 0 if the entity has no such status
+static dds_StatusMask _set_event_callback(
+  GurumddsEventInfo * event_info,
+  dds_StatusMask entity_statuses,
+  rmw_event_type_t event_type,
+  rmw_event_callback_t callback,
+  const void * user_data)
+{
+  dds_StatusMask status_kind = get_status_kind_from_rmw(event_type);
+  if ((status_kind & entity_statuses) == 0) {
+    RMW_SET_ERROR_MSG_WITH_FORMAT_STRING("event %d not supported by this entity", event_type);
+    return 0;
+  }
+
+  bool replayed = event_info->event_callbacks[event_type].set(callback, user_data);
+  // The status may have changed before there was a listener to report it.
+  // Pending events already reported it, and queue drops also show up in
+  // get_status_changes(), so it is not reported twice.
+  if (callback != nullptr && !replayed &&
+    (event_info->get_status_changes() & status_kind) != 0)
+  {
+    event_info->event_callbacks[event_type].notify(1);
+  }
+  return status_kind;
+}
+
+static void _writer_on_event(const dds_DataWriter * a_writer, rmw_event_type_t event_type)
+{
+  dds_DataWriter * writer = const_cast<dds_DataWriter *>(a_writer);
+  auto publisher_info =
+    reinterpret_cast<GurumddsPublisherInfo *>(dds_DataWriter_get_listener_context(writer));
+  if (publisher_info != nullptr) {
+    publisher_info->event_callbacks[event_type].notify(1);
+  }
+}
+
+static void writer_on_liveliness_lost(
+  const dds_DataWriter * writer, const dds_LivelinessLostStatus * status)
+{
+  (void)status;
+  _writer_on_event(writer, RMW_EVENT_LIVELINESS_LOST);
+}
+
+static void writer_on_offered_deadline_missed(
+  const dds_DataWriter * writer, const dds_OfferedDeadlineMissedStatus * status)
+{
+  (void)status;
+  _writer_on_event(writer, RMW_EVENT_OFFERED_DEADLINE_MISSED);
+}
+
+static void writer_on_offered_incompatible_qos(
+  const dds_DataWriter * writer, const dds_OfferedIncompatibleQosStatus * status)
+{
+  (void)status;
+  _writer_on_event(writer, RMW_EVENT_OFFERED_QOS_INCOMPATIBLE);
+}
+
+static void _reader_on_event(const dds_DataReader * a_reader, rmw_event_type_t event_type)
+{
+  dds_DataReader * reader = const_cast<dds_DataReader *>(a_reader);
+  auto subscriber_info =
+    reinterpret_cast<GurumddsSubscriberInfo *>(dds_DataReader_get_listener_context(reader));
+  if (subscriber_info != nullptr) {
+    subscriber_info->event_callbacks[event_type].notify(1);
+  }
+}
+
+static void reader_on_liveliness_changed(
+  const dds_DataReader * reader, const dds_LivelinessChangedStatus * status)
+{
+  (void)status;
+  _reader_on_event(reader, RMW_EVENT_LIVELINESS_CHANGED);
+}
+
+static void reader_on_requested_deadline_missed(
+  const dds_DataReader * reader, const dds_RequestedDeadlineMissedStatus * status)
+{
+  (void)status;
+  _reader_on_event(reader, RMW_EVENT_REQUESTED_DEADLINE_MISSED);
+}
+
+static void reader_on_requested_incompatible_qos(
+  const dds_DataReader * reader, const dds_RequestedIncompatibleQosStatus * status)
+{
+  (void)status;
+  _reader_on_event(reader, RMW_EVENT_REQUESTED_QOS_INCOMPATIBLE);
+}
+
+static void reader_on_sample_lost(const dds_DataReader * reader, const dds_SampleLostStatus * status)
+{
+  (void)status;
+  _reader_on_event(reader, RMW_EVENT_MESSAGE_LOST);
+}
+
 rmw_ret_t GurumddsPublisherInfo::get_status(
   dds_StatusMask mask,
   void * event)
@@ -73,6 +196,31 @@ dds_StatusMask GurumddsPublisherInfo::get_status_changes()
   return dds_DataWriter_get_status_changes(topic_writer);
 }
 
+rmw_ret_t GurumddsPublisherInfo::set_event_callback(
+  rmw_event_type_t event_type, rmw_event_callback_t callback, const void * user_data)
+{
+  if (_set_event_callback(
+      this, WRITER_EVENT_STATUSES, event_type, callback, user_data) == 0)
+  {
+    return RMW_RET_UNSUPPORTED;
+  }
+
+  dds_DataWriterListener datawriter_listener = {};
+  datawriter_listener.on_liveliness_lost = writer_on_liveliness_lost;
+  datawriter_listener.on_offered_deadline_missed = writer_on_offered_deadline_missed;
+  datawriter_listener.on_offered_incompatible_qos = writer_on_offered_incompatible_qos;
+
+  dds_DataWriter_set_listener_context(topic_writer, this);
+  dds_ReturnCode_t ret = dds_DataWriter_set_listener(
+    topic_writer, &datawriter_listener, _get_event_listener_mask(this));
+  if (ret != dds_RETCODE_OK) {
+    RMW_SET_ERROR_MSG("failed to set datawriter listener");
+    return RMW_RET_ERROR;
+  }
+
+  return RMW_RET_OK;
+}
+
 rmw_ret_t GurumddsSubscriberInfo::get_status(
   dds_StatusMask mask,
   void * event)
@@ -127,9 +275,13 @@ rmw_ret_t GurumddsSubscriberInfo::get_status(
       return rmw_ret;
     }
 
+    // Samples lost by DDS and samples dropped from the full message queue
+    uint64_t lost = queue_lost_count.load();
+    uint64_t lost_change = lost - queue_lost_reported.exchange(lost);
+
     auto rmw_status = static_cast<rmw_message_lost_status_t *>(event);
-    rmw_status->total_count = status.total_count;
-    rmw_status->total_count_change = status.total_count_change;
+    rmw_status->total_count = static_cast<size_t>(status.total_count + lost);
+    rmw_status->total_count_change = static_cast<size_t>(status.total_count_change + lost_change);
   } else {
     return RMW_RET_UNSUPPORTED;
   }
@@ -143,5 +295,396 @@ dds_StatusCondition * GurumddsSubscriberInfo::get_statuscondition()
 
 dds_StatusMask GurumddsSubscriberInfo::get_status_changes()
 {
-  return dds_DataReader_get_status_changes(topic_reader);
+  dds_StatusMask mask = dds_DataReader_get_status_changes(topic_reader);
+  if (queue_lost_count.load() != queue_lost_reported.load()) {
+    mask |= dds_SAMPLE_LOST_STATUS;
+  }
+  return mask;
+}
+
+rmw_ret_t GurumddsSubscriberInfo::set_event_callback(
+  rmw_event_type_t event_type, rmw_event_callback_t callback, const void * user_data)
+{
+  if (_set_event_callback(
+      this, READER_EVENT_STATUSES, event_type, callback, user_data) == 0)
+  {
+    return RMW_RET_UNSUPPORTED;
+  }
+
+  dds_DataReaderListener datareader_listener = get_datareader_listener();
+  dds_ReturnCode_t ret =
+    dds_DataReader_set_listener(topic_reader, &datareader_listener, get_listener_mask());
+  if (ret != dds_RETCODE_OK) {
+    RMW_SET_ERROR_MSG("failed to set datareader listener");
+    return RMW_RET_ERROR;
+  }
+
+  return RMW_RET_OK;
+}
+
+dds_StatusMask GurumddsSubscriberInfo::get_listener_mask()
+{
+  dds_StatusMask mask = dds_SUBSCRIPTION_MATCHED_STATUS | _get_event_listener_mask(this);
+  // Samples are left in the reader in direct-take mode
+  if (read_condition == nullptr) {
+    mask |= dds_DATA_AVAILABLE_STATUS;
+  }
+  return mask;
+}
+
+dds_DataReaderListener get_datareader_listener()
+{
+  dds_DataReaderListener datareader_listener = {};
+  datareader_listener.on_data_available = reader_on_data_available<GurumddsSubscriberInfo>;
+  datareader_listener.on_subscription_matched = reader_on_subscription_matched;
+  datareader_listener.on_liveliness_changed = reader_on_liveliness_changed;
+  datareader_listener.on_requested_deadline_missed = reader_on_requested_deadline_missed;
+  datareader_listener.on_requested_incompatible_qos = reader_on_requested_incompatible_qos;
+  datareader_listener.on_sample_lost = reader_on_sample_lost;
+  return datareader_listener;
+}
+
+bool reader_accept_sample(GurumddsSubscriberInfo * subscriber_info, const GurumddsMessage & msg)
+{
+  if (subscriber_info->ignore_local_publications && msg.info != nullptr) {
+    GurumddsPublisherGID publisher_gid;
+    get_publisher_gid(subscriber_info, msg.info->publication_handle, &publisher_gid);
+    if (memcmp(
+        publisher_gid.publication_handle, subscriber_info->participant_guid_prefix,
+        sizeof(subscriber_info->participant_guid_prefix)) == 0)
+    {
+      return false;
+    }
+  }
+
+  if (msg.sample == nullptr || msg.info == nullptr || !msg.info->valid_data) {
+    return true;
+  }
+
+  auto filter = std::atomic_load(&subscriber_info->reader_content_filter);
+  if (filter != nullptr && !filter->evaluate(msg.sample, static_cast<size_t>(msg.size))) {
+    return false;
+  }
+
+  if (subscriber_info->minimum_separation > 0) {
+    // Like TIME_BASED_FILTER, each publication is filtered on its own. Samples
+    // taken by one listener callback share a timestamp, so only the first
+    // sample of each publication passes. The lock keeps concurrent direct
+    // takes from both passing.
+    std::lock_guard<std::mutex> lock(subscriber_info->time_filter_mutex);
+    auto result = subscriber_info->last_accepted_timestamps.emplace(
+      msg.info->publication_handle, msg.received_timestamp);
+    if (!result.second) {
+      if (msg.received_timestamp - result.first->second < subscriber_info->minimum_separation) {
+        subscriber_info->time_filtered_count++;
+        return false;
+      }
+      result.first->second = msg.received_timestamp;
+    }
+  }
+
+  return true;
+}
+
+void reader_on_messages_dropped(GurumddsSubscriberInfo * subscriber_info, size_t count)
+{
+  subscriber_info->queue_lost_count += count;
+  subscriber_info->event_callbacks[RMW_EVENT_MESSAGE_LOST].notify(1);
+}
+
+// Deserializes the sample into a pooled message while the message waits in the
+// queue. Without a free prepared message the take deserializes it instead.
+// Subscriptions only taken serialized never use it, so nothing is prepared
+// before their first deserializing take.
+static void _prepare_message(GurumddsSubscriberInfo * subscriber_info, GurumddsMessage & msg)
+{
+  if (!subscriber_info->deserializing_takes.load(std::memory_order_relaxed)) {
+    return;
+  }
+
+  if (msg.sample == nullptr || msg.info == nullptr || !msg.info->valid_data) {
+    return;
+  }
+
+  MessagePool * message_pool = subscriber_info->message_pool.get();
+  void * ros_message = message_pool->borrow_prepared();
+  if (ros_message == nullptr) {
+    rmw_reset_error();
+    return;
+  }
+
+  bool result = deserialize_cdr_to_ros(
+    subscriber_info->rosidl_message_typesupport->data,
+    subscriber_info->rosidl_message_typesupport->typesupport_identifier,
+    ros_message,
+    msg.sample,
+    static_cast<size_t>(msg.size));
+  if (!result) {
+    // The take deserializes it again and reports the error
+    message_pool->release_message(ros_message);
+    rmw_reset_error();
+    return;
+  }
+
+  msg.ros_message = ros_message;
+  msg.ros_message_owner = message_pool;
+}
+
+static void _drop_queued_message(GurumddsSubscriberInfo * subscriber_info, GurumddsMessage & msg)
+{
+  subscriber_info->queued_bytes -= msg.size;
+  message_queue_free(msg);
+}
+
+static void _drop_over_budget(GurumddsSubscriberInfo * subscriber_info, GurumddsMessage & msg)
+{
+  subscriber_info->budget_dropped_count++;
+  subscriber_info->budget_dropped_bytes += msg.size;
+  message_queue_free(msg);
+}
+
+// Drops messages until size more bytes fit the byte budget. Returns false if
+// the new message is to be dropped instead.
+static bool _reserve_queue_bytes(
+  GurumddsSubscriberInfo * subscriber_info, size_t size, size_t * dropped)
+{
+  size_t budget = subscriber_info->queue_byte_budget;
+  GurumddsMessageQueue & queue = subscriber_info->message_queue;
+  while (subscriber_info->queued_bytes.load() + size > budget && !queue.empty()) {
+    if (subscriber_info->queue_drop_newest) {
+      return false;
+    }
+
+    GurumddsMessage oldest;
+    if (queue.pop(oldest)) {
+      size_t oldest_size = oldest.size;
+      _drop_queued_message(subscriber_info, oldest);
+      subscriber_info->budget_dropped_count++;
+      subscriber_info->budget_dropped_bytes += oldest_size;
+      (*dropped)++;
+    }
+  }
+
+  return true;
+}
+
+bool reader_queue_message(
+  GurumddsSubscriberInfo * subscriber_info, const GurumddsMessage & msg, size_t * dropped)
+{
+  if (!subscriber_info->conflate) {
+    GurumddsMessage queued_msg = msg;
+    if (subscriber_info->queue_byte_budget > 0 &&
+      !_reserve_queue_bytes(subscriber_info, queued_msg.size, dropped))
+    {
+      _drop_over_budget(subscriber_info, queued_msg);
+      (*dropped)++;
+      return false;
+    }
+
+    _prepare_message(subscriber_info, queued_msg);
+
+    // Counted before the push, so a take of the message never sees it missing
+    size_t queued_bytes = (subscriber_info->queued_bytes += queued_msg.size);
+    if (queued_bytes > subscriber_info->peak_queued_bytes.load()) {
+      subscriber_info->peak_queued_bytes.store(queued_bytes);
+    }
+
+    // Like message_queue_push(), keeping the byte count of dropped messages
+    GurumddsMessage oldest;
+    while (!subscriber_info->message_queue.push(queued_msg)) {
+      if (subscriber_info->message_queue.pop(oldest)) {
+        _drop_queued_message(subscriber_info, oldest);
+        (*dropped)++;
+      }
+    }
+    return true;
+  }
+
+  // Takes discard samples without data, so a dispose or unregister must not
+  // replace the last message of its publication
+  if (msg.info == nullptr || !msg.info->valid_data) {
+    GurumddsMessage invalid_msg = msg;
+    message_queue_free(invalid_msg);
+    return false;
+  }
+
+  // The superseded message is freed without ever being deserialized
+  dds_InstanceHandle_t publication_handle = msg.info->publication_handle;
+  std::lock_guard<std::mutex> lock(subscriber_info->conflation_mutex);
+  auto result = subscriber_info->latest_messages.emplace(publication_handle, msg);
+  if (result.second) {
+    return true;
+  }
+
+  message_queue_free(result.first->second);
+  result.first->second = msg;
+  (*dropped)++;
+  return true;
+}
+
+bool queued_message_pop(GurumddsSubscriberInfo * subscriber_info, GurumddsMessage * msg)
+{
+  if (!message_queue_pop(
+      subscriber_info->message_queue, subscriber_info->queue_guard_condition, *msg))
+  {
+    return false;
+  }
+
+  subscriber_info->queued_bytes -= msg->size;
+  return true;
+}
+
+bool conflated_message_pop(GurumddsSubscriberInfo * subscriber_info, GurumddsMessage * msg)
+{
+  std::lock_guard<std::mutex> lock(subscriber_info->conflation_mutex);
+  auto & latest_messages = subscriber_info->latest_messages;
+  auto oldest = latest_messages.end();
+  for (auto it = latest_messages.begin(); it != latest_messages.end(); ++it) {
+    if (oldest == latest_messages.end() ||
+      it->second.reception_sequence_number < oldest->second.reception_sequence_number)
+    {
+      oldest = it;
+    }
+  }
+  if (oldest == latest_messages.end()) {
+    return false;
+  }
+
+  *msg = oldest->second;
+  latest_messages.erase(oldest);
+  // Messages are only added under the lock, and signalled after it is released
+  if (latest_messages.empty()) {
+    dds_GuardCondition_set_trigger_value(subscriber_info->queue_guard_condition, false);
+  }
+  return true;
+}
+
+void conflated_message_clear(GurumddsSubscriberInfo * subscriber_info)
+{
+  std::lock_guard<std::mutex> lock(subscriber_info->conflation_mutex);
+  for (auto & latest_message : subscriber_info->latest_messages) {
+    message_queue_free(latest_message.second);
+  }
+  subscriber_info->latest_messages.clear();
+}
+
+// Erases the entries of publications missing from matched, or all of them if it is null
+template<typename PublicationMap>
+static void _erase_unmatched(
+  PublicationMap & publications, const std::unordered_set<dds_InstanceHandle_t> * matched)
+{
+  for (auto it = publications.begin(); it != publications.end(); ) {
+    if (matched == nullptr || matched->count(it->first) == 0) {
+      it = publications.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+void reader_on_subscription_matched(
+  const dds_DataReader * a_reader, const dds_SubscriptionMatchedStatus * status)
+{
+  dds_DataReader * reader = const_cast<dds_DataReader *>(a_reader);
+  auto subscriber_info =
+    reinterpret_cast<GurumddsSubscriberInfo *>(dds_DataReader_get_listener_context(reader));
+  if (subscriber_info == nullptr || status == nullptr) {
+    return;
+  }
+
+  if (status->current_count_change == -1) {
+    {
+      std::lock_guard<std::mutex> lock(subscriber_info->gid_cache_mutex);
+      subscriber_info->gid_cache.erase(status->last_publication_handle);
+    }
+    std::lock_guard<std::mutex> lock(subscriber_info->time_filter_mutex);
+    subscriber_info->last_accepted_timestamps.erase(status->last_publication_handle);
+    return;
+  }
+
+  if (status->current_count_change < -1) {
+    // Only the last of the unmatched publications is known, so only the ones
+    // still matched are kept. Both are rebuilt as samples arrive, so they are
+    // cleared if the matched publications can't be listed.
+    std::unordered_set<dds_InstanceHandle_t> matched;
+    dds_InstanceHandleSeq * seq = dds_InstanceHandleSeq_create(4);
+    bool listed = seq != nullptr &&
+      dds_DataReader_get_matched_publications(reader, seq) == dds_RETCODE_OK;
+    if (listed) {
+      for (uint32_t i = 0; i < dds_InstanceHandleSeq_length(seq); i++) {
+        matched.insert(dds_InstanceHandleSeq_get(seq, i));
+      }
+    }
+    if (seq != nullptr) {
+      dds_InstanceHandleSeq_delete(seq);
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(subscriber_info->gid_cache_mutex);
+      _erase_unmatched(subscriber_info->gid_cache, listed ? &matched : nullptr);
+    }
+    std::lock_guard<std::mutex> lock(subscriber_info->time_filter_mutex);
+    _erase_unmatched(subscriber_info->last_accepted_timestamps, listed ? &matched : nullptr);
+    return;
+  }
+
+  GurumddsPublisherGID publisher_gid;
+  dds_ReturnCode_t ret = dds_DataReader_get_guid_from_publication_handle(
+    reader, status->last_publication_handle, publisher_gid.publication_handle);
+  if (ret == dds_RETCODE_OK) {
+    std::lock_guard<std::mutex> lock(subscriber_info->gid_cache_mutex);
+    subscriber_info->gid_cache[status->last_publication_handle] = publisher_gid;
+  }
+}
+
+void get_publisher_gid(
+  GurumddsSubscriberInfo * subscriber_info,
+  dds_InstanceHandle_t publication_handle,
+  GurumddsPublisherGID * publisher_gid)
+{
+  {
+    std::lock_guard<std::mutex> lock(subscriber_info->gid_cache_mutex);
+    auto it = subscriber_info->gid_cache.find(publication_handle);
+    if (it != subscriber_info->gid_cache.end()) {
+      *publisher_gid = it->second;
+      return;
+    }
+  }
+
+  dds_ReturnCode_t ret = dds_DataReader_get_guid_from_publication_handle(
+    subscriber_info->topic_reader, publication_handle, publisher_gid->publication_handle);
+  if (ret != dds_RETCODE_OK) {
+    if (ret == dds_RETCODE_ERROR) {
+      RCUTILS_LOG_WARN_NAMED("rmw_gurumdds_cpp", "Failed to get publication handle");
+    }
+    memset(publisher_gid->publication_handle, 0, sizeof(publisher_gid->publication_handle));
+  }
+
+  // Not cached, since samples of an unmatched publication may still be taken
+  // after its entry was erased, and nothing would erase it again
+}
+
+void seed_publisher_gid_cache(GurumddsSubscriberInfo * subscriber_info)
+{
+  dds_InstanceHandleSeq * seq = dds_InstanceHandleSeq_create(4);
+  if (seq == nullptr) {
+    return;
+  }
+
+  if (dds_DataReader_get_matched_publications(subscriber_info->topic_reader, seq) ==
+    dds_RETCODE_OK)
+  {
+    for (uint32_t i = 0; i < dds_InstanceHandleSeq_length(seq); i++) {
+      dds_InstanceHandle_t publication_handle = dds_InstanceHandleSeq_get(seq, i);
+      GurumddsPublisherGID publisher_gid;
+      dds_ReturnCode_t ret = dds_DataReader_get_guid_from_publication_handle(
+        subscriber_info->topic_reader, publication_handle, publisher_gid.publication_handle);
+      if (ret == dds_RETCODE_OK) {
+        std::lock_guard<std::mutex> lock(subscriber_info->gid_cache_mutex);
+        subscriber_info->gid_cache.emplace(publication_handle, publisher_gid);
+      }
+    }
+  }
+
+  dds_InstanceHandleSeq_delete(seq);
 }
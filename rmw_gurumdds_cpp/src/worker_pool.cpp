@@ -0,0 +1,101 @@
+// Copyright 2019 GurumNetworks, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <mutex>
+
+#include "./worker_pool.hpp"
+
+WorkerPool::WorkerPool(size_t thread_count)
+: stopping(false), generation(0), busy_threads(0), task(nullptr), task_count(0), next_index(0)
+{
+  try {
+    for (size_t i = 0; i < thread_count; i++) {
+      threads.emplace_back(&WorkerPool::run, this);
+    }
+  } catch (...) {
+    // The destructor is not run, and joinable threads would terminate the process
+    stop();
+    throw;
+  }
+}
+
+WorkerPool::~WorkerPool()
+{
+  stop();
+}
+
+void WorkerPool::stop()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  work_cv.notify_all();
+  for (auto & thread : threads) {
+    thread.join();
+  }
+}
+
+bool WorkerPool::parallel_for(size_t count, const std::function<void(size_t)> & new_task)
+{
+  // Callers don't wait for each other's loops, they run their own instead
+  std::unique_lock<std::mutex> parallel_for_lock(parallel_for_mutex, std::try_to_lock);
+  if (!parallel_for_lock.owns_lock()) {
+    return false;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    task = &new_task;
+    task_count = count;
+    next_index.store(0);
+    busy_threads = threads.size();
+    generation++;
+  }
+  work_cv.notify_all();
+
+  for (size_t i = next_index++; i < count; i = next_index++) {
+    new_task(i);
+  }
+
+  std::unique_lock<std::mutex> lock(mutex);
+  done_cv.wait(lock, [this] {return busy_threads == 0;});
+  task = nullptr;
+  return true;
+}
+
+void WorkerPool::run()
+{
+  uint64_t last_generation = 0;
+  std::unique_lock<std::mutex> lock(mutex);
+  for (;;) {
+    work_cv.wait(lock, [&] {return stopping || generation != last_generation;});
+    if (stopping) {
+      return;
+    }
+    last_generation = generation;
+    const std::function<void(size_t)> * current_task = task;
+    size_t count = task_count;
+    lock.unlock();
+
+    for (size_t i = next_index++; i < count; i = next_index++) {
+      (*current_task)(i);
+    }
+
+    lock.lock();
+    if (--busy_threads == 0) {
+      done_cv.notify_one();
+    }
+  }
+}
@@ -0,0 +1,67 @@
+// Copyright 2019 GurumNetworks, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef WORKER_POOL_HPP_
+#define WORKER_POOL_HPP_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of threads that run the iterations of a parallel loop together
+// with the calling thread. The pool runs one loop at a time.
+// The constructor throws std::system_error if a thread can't be created.
+class WorkerPool
+{
+public:
+  explicit WorkerPool(size_t thread_count);
+  ~WorkerPool();
+
+  WorkerPool(const WorkerPool &) = delete;
+  WorkerPool & operator=(const WorkerPool &) = delete;
+
+  size_t size() const
+  {
+    return threads.size();
+  }
+
+  // Calls task(i) for every i < count and returns when all calls have returned.
+  // Returns false without calling task if the pool is running another loop.
+  bool parallel_for(size_t count, const std::function<void(size_t)> & task);
+
+private:
+  void run();
+  void stop();
+
+  std::mutex parallel_for_mutex;
+
+  std::mutex mutex;
+  std::condition_variable work_cv;
+  std::condition_variable done_cv;
+  bool stopping;
+  uint64_t generation;
+  size_t busy_threads;
+  const std::function<void(size_t)> * task;
+  size_t task_count;
+  std::atomic<size_t> next_index;
+
+  std::vector<std::thread> threads;
+};
+
+#endif  // WORKER_POOL_HPP_
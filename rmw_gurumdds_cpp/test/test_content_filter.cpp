@@ -0,0 +1,440 @@
+// Copyright 2019 GurumNetworks, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "rmw/error_handling.h"
+
+#include "rosidl_typesupport_introspection_c/field_types.h"
+#include "rosidl_typesupport_introspection_c/identifier.h"
+#include "rosidl_typesupport_introspection_c/message_introspection.h"
+
+#include "../src/content_filter.hpp"
+
+namespace
+{
+
+// Introspection type support of
+//   Inner: int32 a, string label
+//   Sample: bool flag, int32 count, float64 ratio, string name, Inner inner,
+//           int32[] values, Inner[] items, uint8[3] fixed, int64 last
+class TestTypeSupport
+{
+public:
+  TestTypeSupport()
+  {
+    inner_members[0] = member("a", rosidl_typesupport_introspection_c__ROS_TYPE_INT32);
+    inner_members[1] = member("label", rosidl_typesupport_introspection_c__ROS_TYPE_STRING);
+    inner = message("Inner", inner_members, 2);
+    inner_type_support = type_support(&inner);
+
+    sample_members[0] = member("flag", rosidl_typesupport_introspection_c__ROS_TYPE_BOOLEAN);
+    sample_members[1] = member("count", rosidl_typesupport_introspection_c__ROS_TYPE_INT32);
+    sample_members[2] = member("ratio", rosidl_typesupport_introspection_c__ROS_TYPE_DOUBLE);
+    sample_members[3] = member("name", rosidl_typesupport_introspection_c__ROS_TYPE_STRING);
+    sample_members[4] = member("inner", rosidl_typesupport_introspection_c__ROS_TYPE_MESSAGE);
+    sample_members[4].members_ = &inner_type_support;
+    sample_members[5] = member("values", rosidl_typesupport_introspection_c__ROS_TYPE_INT32);
+    sample_members[5].is_array_ = true;
+    sample_members[6] = member("items", rosidl_typesupport_introspection_c__ROS_TYPE_MESSAGE);
+    sample_members[6].members_ = &inner_type_support;
+    sample_members[6].is_array_ = true;
+    sample_members[7] = member("fixed", rosidl_typesupport_introspection_c__ROS_TYPE_UINT8);
+    sample_members[7].is_array_ = true;
+    sample_members[7].array_size_ = 3;
+    sample_members[8] = member("last", rosidl_typesupport_introspection_c__ROS_TYPE_INT64);
+    sample = message("Sample", sample_members, 9);
+    sample_type_support = type_support(&sample);
+  }
+
+  const rosidl_message_type_support_t * get() const
+  {
+    return &sample_type_support;
+  }
+
+private:
+  static rosidl_typesupport_introspection_c__MessageMember member(
+    const char * name, uint8_t type_id)
+  {
+    rosidl_typesupport_introspection_c__MessageMember result{};
+    result.name_ = name;
+    result.type_id_ = type_id;
+    return result;
+  }
+
+  static rosidl_typesupport_introspection_c__MessageMembers message(
+    const char * name, const rosidl_typesupport_introspection_c__MessageMember * members,
+    uint32_t count)
+  {
+    rosidl_typesupport_introspection_c__MessageMembers result{};
+    result.message_namespace_ = "test";
+    result.message_name_ = name;
+    result.member_count_ = count;
+    result.members_ = members;
+    return result;
+  }
+
+  static rosidl_message_type_support_t type_support(
+    const rosidl_typesupport_introspection_c__MessageMembers * members)
+  {
+    rosidl_message_type_support_t result{};
+    result.typesupport_identifier = rosidl_typesupport_introspection_c__identifier;
+    result.data = members;
+    return result;
+  }
+
+  rosidl_typesupport_introspection_c__MessageMember inner_members[2];
+  rosidl_typesupport_introspection_c__MessageMembers inner;
+  rosidl_message_type_support_t inner_type_support;
+  rosidl_typesupport_introspection_c__MessageMember sample_members[9];
+  rosidl_typesupport_introspection_c__MessageMembers sample;
+  rosidl_message_type_support_t sample_type_support;
+};
+
+// Writes CDR in the byte order given by the encapsulation header
+class CDRWriter
+{
+public:
+  explicit CDRWriter(bool big_endian = false)
+  : big_endian(big_endian)
+  {
+    buffer = {0x00, static_cast<uint8_t>(big_endian ? 0x00 : 0x01), 0x00, 0x00};
+  }
+
+  CDRWriter & u8(uint8_t value)
+  {
+    return put(&value, 1);
+  }
+
+  CDRWriter & i32(int32_t value)
+  {
+    return put(&value, 4);
+  }
+
+  CDRWriter & i64(int64_t value)
+  {
+    return put(&value, 8);
+  }
+
+  CDRWriter & f64(double value)
+  {
+    return put(&value, 8);
+  }
+
+  CDRWriter & str(const std::string & value)
+  {
+    i32(static_cast<int32_t>(value.size() + 1));
+    buffer.insert(buffer.end(), value.begin(), value.end());
+    buffer.push_back('\0');
+    return *this;
+  }
+
+  std::vector<uint8_t> buffer;
+
+private:
+  CDRWriter & put(const void * value, size_t size)
+  {
+    while ((buffer.size() - 4) % size != 0) {
+      buffer.push_back(0);
+    }
+    const uint8_t * bytes = static_cast<const uint8_t *>(value);
+    for (size_t i = 0; i < size; i++) {
+      buffer.push_back(bytes[big_endian ? size - 1 - i : i]);
+    }
+    return *this;
+  }
+
+  bool big_endian;
+};
+
+struct SampleValues
+{
+  bool flag = false;
+  int32_t count = 3;
+  double ratio = 0.5;
+  std::string name = "test";
+  int32_t inner_a = 11;
+  std::string inner_label = "in";
+  std::vector<int32_t> values = {10, 20, 30};
+  std::vector<std::string> item_labels = {"a", "b"};
+  uint8_t fixed[3] = {7, 8, 9};
+  int64_t last = -7;
+};
+
+std::vector<uint8_t> serialize(const SampleValues & values, bool big_endian = false)
+{
+  CDRWriter writer(big_endian);
+  writer.u8(values.flag ? 1 : 0).i32(values.count).f64(values.ratio).str(values.name);
+  writer.i32(values.inner_a).str(values.inner_label);
+  writer.i32(static_cast<int32_t>(values.values.size()));
+  for (int32_t value : values.values) {
+    writer.i32(value);
+  }
+  writer.i32(static_cast<int32_t>(values.item_labels.size()));
+  for (size_t i = 0; i < values.item_labels.size(); i++) {
+    writer.i32(static_cast<int32_t>(i + 1)).str(values.item_labels[i]);
+  }
+  writer.u8(values.fixed[0]).u8(values.fixed[1]).u8(values.fixed[2]).i64(values.last);
+  return writer.buffer;
+}
+
+class TestContentFilter : public ::testing::Test
+{
+protected:
+  void TearDown() override
+  {
+    rmw_reset_error();
+  }
+
+  std::shared_ptr<ContentFilter> create(
+    const std::string & expression, const std::vector<std::string> & parameters = {})
+  {
+    return ContentFilter::create(type_support.get(), expression, parameters);
+  }
+
+  bool matches(
+    const std::string & expression, const SampleValues & values = SampleValues(),
+    const std::vector<std::string> & parameters = {})
+  {
+    auto filter = create(expression, parameters);
+    EXPECT_NE(filter, nullptr) << expression;
+    if (filter == nullptr) {
+      return false;
+    }
+    std::vector<uint8_t> sample = serialize(values);
+    return filter->evaluate(sample.data(), sample.size());
+  }
+
+  TestTypeSupport type_support;
+};
+
+}  // namespace
+
+TEST_F(TestContentFilter, comparison_operators) {
+  EXPECT_TRUE(matches("count = 3"));
+  EXPECT_TRUE(matches("count == 3"));
+  EXPECT_TRUE(matches("count <> 4"));
+  EXPECT_TRUE(matches("count != 4"));
+  EXPECT_TRUE(matches("count < 4"));
+  EXPECT_TRUE(matches("count <= 3"));
+  EXPECT_TRUE(matches("count > 2"));
+  EXPECT_TRUE(matches("count >= 3"));
+  EXPECT_FALSE(matches("count > 3"));
+  EXPECT_TRUE(matches("4 > count"));
+  EXPECT_TRUE(matches("count > -1"));
+  EXPECT_TRUE(matches("ratio > 0.25"));
+  EXPECT_TRUE(matches("ratio = 5e-1"));
+  EXPECT_FALSE(matches("ratio < 0.5"));
+  EXPECT_TRUE(matches("last < 0"));
+  EXPECT_TRUE(matches("last = -7"));
+}
+
+TEST_F(TestContentFilter, operator_precedence) {
+  SampleValues values;
+  values.count = 1;
+  EXPECT_TRUE(matches("count = 1 OR count = 2 AND flag = TRUE", values));
+  EXPECT_FALSE(matches("(count = 1 OR count = 2) AND flag = TRUE", values));
+  values.count = 2;
+  EXPECT_FALSE(matches("count = 1 OR count = 2 AND flag = TRUE", values));
+  EXPECT_TRUE(matches("count = 2 AND flag = FALSE OR count = 1", values));
+  EXPECT_TRUE(matches("count = 2 and flag = false", values));
+}
+
+TEST_F(TestContentFilter, not_operator) {
+  EXPECT_FALSE(matches("NOT count = 3"));
+  EXPECT_TRUE(matches("NOT count = 4"));
+  EXPECT_TRUE(matches("NOT NOT count = 3"));
+  EXPECT_TRUE(matches("NOT count = 4 AND count = 3"));
+  EXPECT_FALSE(matches("NOT (count = 3 OR count = 4)"));
+}
+
+TEST_F(TestContentFilter, between) {
+  EXPECT_TRUE(matches("count BETWEEN 1 AND 5"));
+  EXPECT_TRUE(matches("count BETWEEN 3 AND 3"));
+  EXPECT_FALSE(matches("count BETWEEN 4 AND 5"));
+  EXPECT_FALSE(matches("count NOT BETWEEN 1 AND 5"));
+  EXPECT_TRUE(matches("count NOT BETWEEN 4 AND 5"));
+  EXPECT_TRUE(matches("count BETWEEN 1 AND 5 AND flag = FALSE"));
+  EXPECT_FALSE(matches("count BETWEEN 1 AND 5 AND flag = TRUE"));
+  EXPECT_TRUE(matches("ratio BETWEEN 0 AND 1"));
+}
+
+TEST_F(TestContentFilter, like) {
+  EXPECT_TRUE(matches("name LIKE 'test'"));
+  EXPECT_TRUE(matches("name LIKE 'te%'"));
+  EXPECT_TRUE(matches("name LIKE '%st'"));
+  EXPECT_TRUE(matches("name LIKE '%'"));
+  EXPECT_TRUE(matches("name LIKE 't_st'"));
+  EXPECT_FALSE(matches("name LIKE 't_t'"));
+  EXPECT_FALSE(matches("name LIKE 'x%'"));
+  EXPECT_TRUE(matches("name NOT LIKE '%x%'"));
+  EXPECT_FALSE(matches("name NOT LIKE 'te%'"));
+  // LIKE only applies to strings
+  EXPECT_FALSE(matches("count LIKE '3'"));
+}
+
+TEST_F(TestContentFilter, parameters) {
+  EXPECT_TRUE(matches("count > %0 AND name = %1", SampleValues(), {"2", "'test'"}));
+  EXPECT_FALSE(matches("count > %0 AND name = %1", SampleValues(), {"3", "'test'"}));
+  // Unquoted parameters are strings
+  EXPECT_TRUE(matches("name = %0", SampleValues(), {"test"}));
+  EXPECT_TRUE(matches("flag = %0", SampleValues(), {"FALSE"}));
+  EXPECT_TRUE(matches("ratio < %0", SampleValues(), {"0.75"}));
+  EXPECT_TRUE(matches("count BETWEEN %0 AND %1", SampleValues(), {"-1", "3"}));
+  EXPECT_TRUE(matches("name LIKE %0", SampleValues(), {"'t%'"}));
+  EXPECT_TRUE(matches("count = %1", SampleValues(), {"0", "3"}));
+
+  auto filter = create("count = %0", {"3"});
+  ASSERT_NE(filter, nullptr);
+  EXPECT_EQ(filter->get_expression(), "count = %0");
+  ASSERT_EQ(filter->get_parameters().size(), 1u);
+  EXPECT_EQ(filter->get_parameters()[0], "3");
+}
+
+TEST_F(TestContentFilter, nested_and_sequence_fields) {
+  EXPECT_TRUE(matches("inner.a = 11"));
+  EXPECT_TRUE(matches("inner.label = 'in'"));
+  EXPECT_TRUE(matches("values[0] = 10"));
+  EXPECT_TRUE(matches("values[2] = 30"));
+  EXPECT_TRUE(matches("items[0].label = 'a'"));
+  EXPECT_TRUE(matches("items[1].a = 2 AND items[1].label = 'b'"));
+  EXPECT_TRUE(matches("fixed[0] = 7 AND fixed[2] = 9"));
+  // Fields after sequences of strings and nested messages are found by skipping them
+  EXPECT_TRUE(matches("last = -7"));
+
+  // Elements out of range never match, whatever the operator
+  EXPECT_FALSE(matches("values[3] = 0"));
+  EXPECT_FALSE(matches("values[3] <> 0"));
+  EXPECT_FALSE(matches("items[2].a = 3"));
+
+  SampleValues values;
+  values.values.clear();
+  values.item_labels.clear();
+  EXPECT_FALSE(matches("values[0] = 10", values));
+  EXPECT_TRUE(matches("last = -7", values));
+}
+
+TEST_F(TestContentFilter, string_and_bool_fields) {
+  EXPECT_TRUE(matches("flag = FALSE"));
+  EXPECT_TRUE(matches("flag <> TRUE"));
+  EXPECT_TRUE(matches("flag = 0"));
+  EXPECT_TRUE(matches("name = 'test'"));
+  EXPECT_TRUE(matches("name = `test'"));
+  EXPECT_TRUE(matches("name <> 'other'"));
+  EXPECT_TRUE(matches("name < 'tesu'"));
+  EXPECT_TRUE(matches("name > 'tes'"));
+  // Strings never compare with numbers
+  EXPECT_FALSE(matches("name = 3"));
+  EXPECT_FALSE(matches("name <> 3"));
+
+  SampleValues values;
+  values.flag = true;
+  values.name = "";
+  EXPECT_TRUE(matches("flag = TRUE", values));
+  EXPECT_TRUE(matches("name = ''", values));
+  EXPECT_TRUE(matches("name LIKE '%'", values));
+}
+
+TEST_F(TestContentFilter, big_endian_samples) {
+  auto filter = create("count = 3 AND last = -7 AND items[1].label = 'b'");
+  ASSERT_NE(filter, nullptr);
+  std::vector<uint8_t> sample = serialize(SampleValues(), true);
+  EXPECT_TRUE(filter->evaluate(sample.data(), sample.size()));
+}
+
+TEST_F(TestContentFilter, malformed_samples) {
+  auto filter = create("last = -7");
+  ASSERT_NE(filter, nullptr);
+  std::vector<uint8_t> sample = serialize(SampleValues());
+  ASSERT_TRUE(filter->evaluate(sample.data(), sample.size()));
+
+  // Truncated samples never match
+  for (size_t size = 0; size < sample.size(); size++) {
+    std::vector<uint8_t> truncated(sample.begin(), sample.begin() + size);
+    EXPECT_FALSE(filter->evaluate(truncated.data(), truncated.size())) << size;
+  }
+
+  // A string that is not null terminated
+  std::vector<uint8_t> unterminated = CDRWriter().u8(0).i32(3).f64(0.5).i32(2).buffer;
+  unterminated.push_back('a');
+  unterminated.push_back('b');
+  auto name_filter = create("name = 'a'");
+  ASSERT_NE(name_filter, nullptr);
+  EXPECT_FALSE(name_filter->evaluate(unterminated.data(), unterminated.size()));
+
+  // Lengths larger than the sample
+  SampleValues values;
+  values.values.clear();
+  std::vector<uint8_t> huge_sequence = serialize(values);
+  const size_t values_length_offset = 4 + 40;
+  uint32_t huge = 0x7fffffff;
+  memcpy(&huge_sequence[values_length_offset], &huge, sizeof(huge));
+  EXPECT_FALSE(filter->evaluate(huge_sequence.data(), huge_sequence.size()));
+  auto values_filter = create("values[1000] = 0");
+  ASSERT_NE(values_filter, nullptr);
+  EXPECT_FALSE(values_filter->evaluate(huge_sequence.data(), huge_sequence.size()));
+
+  std::vector<uint8_t> huge_string = serialize(SampleValues());
+  const size_t name_length_offset = 4 + 16;
+  memcpy(&huge_string[name_length_offset], &huge, sizeof(huge));
+  EXPECT_FALSE(name_filter->evaluate(huge_string.data(), huge_string.size()));
+  EXPECT_FALSE(filter->evaluate(huge_string.data(), huge_string.size()));
+}
+
+TEST_F(TestContentFilter, rejects_bad_expressions) {
+  const char * expressions[] = {
+    "",
+    "count",
+    "count =",
+    "count = 1 AND",
+    "count = 1 OR OR count = 2",
+    "(count = 1",
+    "count = 1)",
+    "count 1",
+    "count ! 1",
+    "count = 'unterminated",
+    "count = 0x",
+    "count = 1.2.3",
+    "count = 99999999999999999999",
+    "count = $",
+    "count NOT = 1",
+    "count BETWEEN 1",
+    "count BETWEEN 1 OR 5",
+    "count = %",
+    "count = %0",
+    "unknown = 1",
+    "inner = 1",
+    "inner.unknown = 1",
+    "values = 1",
+    "count[0] = 1",
+    "values[x] = 1",
+    "values[] = 1",
+    "items[0] = 1",
+    "count.a = 1",
+  };
+  for (const char * expression : expressions) {
+    EXPECT_EQ(create(expression), nullptr) << expression;
+    EXPECT_TRUE(rmw_error_is_set()) << expression;
+    rmw_reset_error();
+  }
+
+  EXPECT_EQ(create("count = %1", {"0"}), nullptr);
+  rmw_reset_error();
+}
@@ -0,0 +1,175 @@
+// Copyright 2019 GurumNetworks, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RMW_GURUMDDS_SHARED_CPP__MESSAGE_QUEUE_HPP_
+#define RMW_GURUMDDS_SHARED_CPP__MESSAGE_QUEUE_HPP_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+
+// Bounded multi-producer/multi-consumer ring buffer.
+// Each cell carries a sequence number that tells producers and consumers
+// whether it is free for the current lap, so push() and pop() only contend
+// on a single compare-and-swap of their own position counter.
+template<typename T>
+class MessageQueue
+{
+public:
+  MessageQueue()
+  : mask(0), limit(0), enqueue_pos(0), dequeue_pos(0)
+  {}
+
+  MessageQueue(const MessageQueue &) = delete;
+  MessageQueue & operator=(const MessageQueue &) = delete;
+
+  // Must be called once before the queue is shared with other threads.
+  // The ring is rounded up to a power of two of at least two cells, so the
+  // cell sequence numbers stay unambiguous, but never holds more than
+  // capacity elements.
+  bool init(size_t capacity)
+  {
+    if (capacity == 0) {
+      capacity = 1;
+    }
+
+    size_t size = 2;
+    while (size < capacity) {
+      size <<= 1;
+    }
+
+    buffer.reset(new(std::nothrow) Cell[size]);
+    if (!buffer) {
+      return false;
+    }
+
+    for (size_t i = 0; i < size; i++) {
+      buffer[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    mask = size - 1;
+    limit = capacity;
+    enqueue_pos.store(0, std::memory_order_relaxed);
+    dequeue_pos.store(0, std::memory_order_relaxed);
+    return true;
+  }
+
+  size_t capacity() const
+  {
+    return limit;
+  }
+
+  // Number of elements claimed by producers and not yet claimed by consumers
+  size_t size() const
+  {
+    size_t head = dequeue_pos.load(std::memory_order_acquire);
+    size_t tail = enqueue_pos.load(std::memory_order_acquire);
+    return tail > head ? tail - head : 0;
+  }
+
+  // Returns false if the queue is full
+  bool push(const T & value)
+  {
+    if (!buffer) {
+      return false;
+    }
+
+    Cell * cell;
+    size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+    for (;;) {
+      cell = &buffer[pos & mask];
+      size_t seq = cell->sequence.load(std::memory_order_acquire);
+      intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+      if (diff == 0) {
+        if (pos - dequeue_pos.load(std::memory_order_acquire) >= limit) {
+          return false;
+        }
+        if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = enqueue_pos.load(std::memory_order_relaxed);
+      }
+    }
+
+    cell->data = value;
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Returns false if the queue is empty
+  bool pop(T & value)
+  {
+    if (!buffer) {
+      return false;
+    }
+
+    Cell * cell;
+    size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+    for (;;) {
+      cell = &buffer[pos & mask];
+      size_t seq = cell->sequence.load(std::memory_order_acquire);
+      intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+      if (diff == 0) {
+        if (dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = dequeue_pos.load(std::memory_order_relaxed);
+      }
+    }
+
+    value = cell->data;
+    cell->sequence.store(pos + mask + 1, std::memory_order_release);
+    return true;
+  }
+
+  // True if no element was published at the head of the queue when checked
+  bool empty() const
+  {
+    if (!buffer) {
+      return true;
+    }
+
+    size_t pos = dequeue_pos.load(std::memory_order_acquire);
+    size_t seq = buffer[pos & mask].sequence.load(std::memory_order_acquire);
+    return static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1) < 0;
+  }
+
+private:
+  static const size_t CACHELINE_SIZE = 64;
+
+  struct Cell
+  {
+    std::atomic<size_t> sequence;
+    T data;
+  };
+
+  std::unique_ptr<Cell[]> buffer;
+  size_t mask;
+  size_t limit;
+  // Keep producers and consumers off each other's cache line
+  char pad0[CACHELINE_SIZE];
+  std::atomic<size_t> enqueue_pos;
+  char pad1[CACHELINE_SIZE];
+  std::atomic<size_t> dequeue_pos;
+  char pad2[CACHELINE_SIZE];
+};
+
+#endif  // RMW_GURUMDDS_SHARED_CPP__MESSAGE_QUEUE_HPP_
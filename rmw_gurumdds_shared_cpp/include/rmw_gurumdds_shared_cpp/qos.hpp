@@ -40,6 +40,11 @@ get_datareader_qos(
   const rmw_qos_profile_t * qos_profile,
   dds_DataReaderQos * datareader_qos);
 
+// Number of messages a reader's message queue has to hold for the given QoS
+RMW_GURUMDDS_SHARED_CPP_PUBLIC
+size_t
+get_message_queue_capacity(const dds_DataReaderQos * datareader_qos);
+
 enum rmw_qos_reliability_policy_t
 convert_reliability(
   dds_ReliabilityQosPolicy policy);
@@ -16,12 +16,14 @@
 #define RMW_GURUMDDS_SHARED_CPP__RMW_COMMON_HPP_
 
 #include "./visibility_control.h"
+#include "./dds_include.hpp"
 
 #include "rmw/error_handling.h"
 #include "rmw/rmw.h"
 #include "rmw/types.h"
 #include "rmw/names_and_types.h"
 #include "rmw/event.h"
+#include "rmw/event_callback_type.h"
 #include "rmw/topic_endpoint_info_array.h"
 
 RMW_GURUMDDS_SHARED_CPP_PUBLIC
@@ -119,6 +121,12 @@ shared__rmw_destroy_wait_set(
   const char * implementation_identifier,
   rmw_wait_set_t * wait_set);
 
+// Wait sets keep conditions attached between waits. This detaches the
+// condition from all of them, and must be called before it is deleted.
+RMW_GURUMDDS_SHARED_CPP_PUBLIC
+void
+shared__rmw_wait_set_forget_condition(dds_Condition * condition);
+
 RMW_GURUMDDS_SHARED_CPP_PUBLIC
 rmw_ret_t
 shared__rmw_get_subscriber_names_and_types_by_node(
@@ -215,6 +223,14 @@ shared__rmw_take_event(
   void * event_info,
   bool * taken);
 
+RMW_GURUMDDS_SHARED_CPP_PUBLIC
+rmw_ret_t
+shared__rmw_event_set_callback(
+  const char * implementation_identifier,
+  rmw_event_t * event_handle,
+  rmw_event_callback_t callback,
+  const void * user_data);
+
 RMW_GURUMDDS_SHARED_CPP_PUBLIC
 rmw_ret_t
 shared__rmw_node_assert_liveliness(
@@ -16,6 +16,7 @@
 #define RMW_GURUMDDS_SHARED_CPP__RMW_WAIT_HPP_
 
 #include <chrono>
+#include <mutex>
 #include <unordered_map>
 #include <unordered_set>
 #include <utility>
@@ -30,20 +31,6 @@
 #include "rmw_gurumdds_shared_cpp/dds_include.hpp"
 #include "rmw_gurumdds_shared_cpp/event_converter.hpp"
 
-#define CHECK_ATTACH(ret) \
-  if (ret == dds_RETCODE_OK) { \
-    continue; \
-  } else if (ret == dds_RETCODE_OUT_OF_RESOURCES) { \
-    RMW_SET_ERROR_MSG("failed to attach condition to wait set: out of resources"); \
-    return RMW_RET_ERROR; \
-  } else if (ret == dds_RETCODE_BAD_PARAMETER) { \
-    RMW_SET_ERROR_MSG("failed to attach condition to wait set: condition pointer was invalid"); \
-    return RMW_RET_ERROR; \
-  } else { \
-    RMW_SET_ERROR_MSG("failed to attach condition to wait set"); \
-    return RMW_RET_ERROR; \
-  }
-
 rmw_ret_t
 __gather_event_conditions(
   rmw_events_t * events,
@@ -78,7 +65,10 @@ __gather_event_conditions(
   }
 
   for (auto & map_pair : status_map) {
-    dds_StatusCondition_set_enabled_statuses(map_pair.first, map_pair.second);
+    // The same events are usually waited on every time
+    if (dds_StatusCondition_get_enabled_statuses(map_pair.first) != map_pair.second) {
+      dds_StatusCondition_set_enabled_statuses(map_pair.first, map_pair.second);
+    }
     status_conditions.insert(map_pair.first);
   }
 
@@ -131,98 +121,155 @@ rmw_ret_t __detach_condition(
   return RMW_RET_OK;
 }
 
+// Marks the condition as used by the current wait, attaching it unless an
+// earlier wait left it attached
+rmw_ret_t __attach_condition(
+  GurumddsWaitSetInfo * wait_set_info,
+  dds_Condition * condition)
+{
+  auto result = wait_set_info->attached.emplace(condition, wait_set_info->wait_count);
+  if (!result.second) {
+    result.first->second = wait_set_info->wait_count;
+    return RMW_RET_OK;
+  }
+
+  dds_ReturnCode_t ret = dds_WaitSet_attach_condition(wait_set_info->wait_set, condition);
+  if (ret == dds_RETCODE_OK) {
+    return RMW_RET_OK;
+  }
+
+  wait_set_info->attached.erase(result.first);
+  if (ret == dds_RETCODE_OUT_OF_RESOURCES) {
+    RMW_SET_ERROR_MSG("failed to attach condition to wait set: out of resources");
+  } else if (ret == dds_RETCODE_BAD_PARAMETER) {
+    RMW_SET_ERROR_MSG("failed to attach condition to wait set: condition pointer was invalid");
+  } else {
+    RMW_SET_ERROR_MSG("failed to attach condition to wait set");
+  }
+  return RMW_RET_ERROR;
+}
+
+// Detaches the conditions that the current wait did not mark
+rmw_ret_t __detach_unused_conditions(GurumddsWaitSetInfo * wait_set_info)
+{
+  auto & attached = wait_set_info->attached;
+  for (auto it = attached.begin(); it != attached.end(); ) {
+    if (it->second == wait_set_info->wait_count) {
+      ++it;
+      continue;
+    }
+
+    rmw_ret_t rmw_ret_code = __detach_condition(wait_set_info->wait_set, it->first);
+    if (rmw_ret_code != RMW_RET_OK) {
+      return rmw_ret_code;
+    }
+    it = attached.erase(it);
+  }
+
+  return RMW_RET_OK;
+}
+
+// Subscriptions in direct-take mode are woken up by a read condition on the reader
+template<typename SubscriberInfo>
+dds_Condition *
+__get_subscriber_condition(SubscriberInfo * subscriber_info)
+{
+  if (subscriber_info->read_condition != nullptr) {
+    return reinterpret_cast<dds_Condition *>(subscriber_info->read_condition);
+  }
+  return reinterpret_cast<dds_Condition *>(subscriber_info->queue_guard_condition);
+}
+
+// Collects the conditions of the entities that are already triggered into
+// the active set, without touching the DDS wait set. Returns false with an
+// empty set if none is; null handles are left for the full wait to report.
 template<typename SubscriberInfo, typename ServiceInfo, typename ClientInfo>
-rmw_ret_t
-shared__rmw_wait(
-  const char * implementation_identifier,
+bool
+__collect_triggered_conditions(
+  GurumddsWaitSetInfo * wait_set_info,
   rmw_subscriptions_t * subscriptions,
   rmw_guard_conditions_t * guard_conditions,
   rmw_services_t * services,
-  rmw_clients_t * clients,
-  rmw_events_t * events,
-  rmw_wait_set_t * wait_set,
-  const rmw_time_t * wait_timeout)
+  rmw_clients_t * clients)
 {
-  (void)events;
-  struct atexit_t
-  {
-    ~atexit_t()
-    {
-      if (wait_set == nullptr) {
-        RMW_SET_ERROR_MSG("wait set handle is null");
-        return;
-      }
-
-      RMW_CHECK_TYPE_IDENTIFIERS_MATCH(
-        wait set handle, wait_set->implementation_identifier,
-        implementation_identifier, return )
+  auto & active = wait_set_info->active;
+  active.clear();
 
-      GurumddsWaitSetInfo * wait_set_info = static_cast<GurumddsWaitSetInfo *>(wait_set->data);
-      if (wait_set_info == nullptr) {
-        RMW_SET_ERROR_MSG("WaitSet implementation struct is null");
-        return;
+  if (subscriptions != nullptr) {
+    for (size_t i = 0; i < subscriptions->subscriber_count; ++i) {
+      SubscriberInfo * subscriber_info =
+        static_cast<SubscriberInfo *>(subscriptions->subscribers[i]);
+      dds_Condition * condition =
+        subscriber_info != nullptr ? __get_subscriber_condition(subscriber_info) : nullptr;
+      if (condition == nullptr) {
+        active.clear();
+        return false;
       }
-
-      dds_WaitSet * dds_wait_set = static_cast<dds_WaitSet *>(wait_set_info->wait_set);
-      if (dds_wait_set == nullptr) {
-        RMW_SET_ERROR_MSG("DDS wait set handle is null");
-        return;
+      if (dds_Condition_get_trigger_value(condition)) {
+        active.insert(condition);
       }
+    }
+  }
 
-      dds_ConditionSeq * attached_conditions =
-        static_cast<dds_ConditionSeq *>(wait_set_info->attached_conditions);
-      if (attached_conditions == nullptr) {
-        RMW_SET_ERROR_MSG("DDS condition sequence handle is null");
-        return;
+  if (guard_conditions != nullptr) {
+    for (size_t i = 0; i < guard_conditions->guard_condition_count; ++i) {
+      dds_Condition * condition =
+        static_cast<dds_Condition *>(guard_conditions->guard_conditions[i]);
+      if (condition == nullptr) {
+        active.clear();
+        return false;
       }
-
-      dds_ReturnCode_t ret = dds_WaitSet_get_conditions(dds_wait_set, attached_conditions);
-      if (ret != dds_RETCODE_OK) {
-        RMW_SET_ERROR_MSG("failed to get attached conditions for wait set");
-        return;
+      if (dds_Condition_get_trigger_value(condition)) {
+        active.insert(condition);
       }
+    }
+  }
 
-      for (uint32_t i = 0; i < dds_ConditionSeq_length(attached_conditions); ++i) {
-        ret = dds_WaitSet_detach_condition(
-          dds_wait_set, dds_ConditionSeq_get(attached_conditions, i));
-        if (ret != dds_RETCODE_OK) {
-          RMW_SET_ERROR_MSG("failed to detach condition from wait set");
-        }
+  if (services != nullptr) {
+    for (size_t i = 0; i < services->service_count; ++i) {
+      ServiceInfo * service_info = static_cast<ServiceInfo *>(services->services[i]);
+      if (service_info == nullptr || service_info->queue_guard_condition == nullptr) {
+        active.clear();
+        return false;
+      }
+      auto condition = reinterpret_cast<dds_Condition *>(service_info->queue_guard_condition);
+      if (dds_Condition_get_trigger_value(condition)) {
+        active.insert(condition);
       }
     }
-    rmw_wait_set_t * wait_set = nullptr;
-    const char * implementation_identifier = nullptr;
-  } atexit;
-
-  atexit.wait_set = wait_set;
-  atexit.implementation_identifier = implementation_identifier;
-
-  if (wait_set == nullptr) {
-    RMW_SET_ERROR_MSG("wait set handle is null");
-    return RMW_RET_ERROR;
   }
-  RMW_CHECK_TYPE_IDENTIFIERS_MATCH(
-    wait set handle, wait_set->implementation_identifier,
-    implementation_identifier, return RMW_RET_ERROR);
 
-  GurumddsWaitSetInfo * wait_set_info = static_cast<GurumddsWaitSetInfo *>(wait_set->data);
-  if (wait_set_info == nullptr) {
-    RMW_SET_ERROR_MSG("WaitSet implementation struct is null");
-    return RMW_RET_ERROR;
+  if (clients != nullptr) {
+    for (size_t i = 0; i < clients->client_count; ++i) {
+      ClientInfo * client_info = static_cast<ClientInfo *>(clients->clients[i]);
+      if (client_info == nullptr || client_info->queue_guard_condition == nullptr) {
+        active.clear();
+        return false;
+      }
+      auto condition = reinterpret_cast<dds_Condition *>(client_info->queue_guard_condition);
+      if (dds_Condition_get_trigger_value(condition)) {
+        active.insert(condition);
+      }
+    }
   }
 
-  dds_WaitSet * dds_wait_set = static_cast<dds_WaitSet *>(wait_set_info->wait_set);
-  if (dds_wait_set == nullptr) {
-    RMW_SET_ERROR_MSG("DDS wait set handle is null");
-    return RMW_RET_ERROR;
-  }
+  return !active.empty();
+}
 
-  dds_ConditionSeq * active_conditions =
-    static_cast<dds_ConditionSeq *>(wait_set_info->active_conditions);
-  if (active_conditions == nullptr) {
-    RMW_SET_ERROR_MSG("DDS condition sequence handle is null");
-    return RMW_RET_ERROR;
-  }
+// Executors wait on mostly the same entities every time, so conditions stay
+// attached and only the ones added or removed since the last wait change.
+// Called with the wait set mutex held.
+template<typename SubscriberInfo, typename ServiceInfo, typename ClientInfo>
+rmw_ret_t
+__attach_conditions(
+  GurumddsWaitSetInfo * wait_set_info,
+  rmw_subscriptions_t * subscriptions,
+  rmw_guard_conditions_t * guard_conditions,
+  rmw_services_t * services,
+  rmw_clients_t * clients,
+  rmw_events_t * events)
+{
+  wait_set_info->wait_count++;
 
   if (subscriptions != nullptr) {
     for (size_t i = 0; i < subscriptions->subscriber_count; ++i) {
@@ -233,15 +280,16 @@ shared__rmw_wait(
         return RMW_RET_ERROR;
       }
 
-      dds_GuardCondition * queue_guard_condition = subscriber_info->queue_guard_condition;
-      if (queue_guard_condition == nullptr) {
+      dds_Condition * condition = __get_subscriber_condition(subscriber_info);
+      if (condition == nullptr) {
         RMW_SET_ERROR_MSG("read condition handle is null");
         return RMW_RET_ERROR;
       }
 
-      dds_ReturnCode_t ret = dds_WaitSet_attach_condition(
-        dds_wait_set, reinterpret_cast<dds_Condition *>(queue_guard_condition));
-      CHECK_ATTACH(ret);
+      rmw_ret_t rmw_ret_code = __attach_condition(wait_set_info, condition);
+      if (rmw_ret_code != RMW_RET_OK) {
+        return rmw_ret_code;
+      }
     }
   }
 
@@ -253,10 +301,11 @@ shared__rmw_wait(
   }
 
   for (auto status_condition : status_conditions) {
-    dds_ReturnCode_t ret = dds_WaitSet_attach_condition(
-      dds_wait_set,
-      reinterpret_cast<dds_Condition *>(status_condition));
-    CHECK_ATTACH(ret);
+    ret_code = __attach_condition(
+      wait_set_info, reinterpret_cast<dds_Condition *>(status_condition));
+    if (ret_code != RMW_RET_OK) {
+      return ret_code;
+    }
   }
 
   if (guard_conditions != nullptr) {
@@ -268,9 +317,11 @@ shared__rmw_wait(
         return RMW_RET_ERROR;
       }
 
-      dds_ReturnCode_t ret = dds_WaitSet_attach_condition(
-        dds_wait_set, reinterpret_cast<dds_Condition *>(guard_condition));
-      CHECK_ATTACH(ret);
+      rmw_ret_t rmw_ret_code = __attach_condition(
+        wait_set_info, reinterpret_cast<dds_Condition *>(guard_condition));
+      if (rmw_ret_code != RMW_RET_OK) {
+        return rmw_ret_code;
+      }
     }
   }
 
@@ -288,9 +339,11 @@ shared__rmw_wait(
         return RMW_RET_ERROR;
       }
 
-      dds_ReturnCode_t ret = dds_WaitSet_attach_condition(
-        dds_wait_set, reinterpret_cast<dds_Condition *>(queue_guard_condition));
-      CHECK_ATTACH(ret);
+      rmw_ret_t rmw_ret_code = __attach_condition(
+        wait_set_info, reinterpret_cast<dds_Condition *>(queue_guard_condition));
+      if (rmw_ret_code != RMW_RET_OK) {
+        return rmw_ret_code;
+      }
     }
   }
 
@@ -308,12 +361,24 @@ shared__rmw_wait(
         return RMW_RET_ERROR;
       }
 
-      dds_ReturnCode_t ret = dds_WaitSet_attach_condition(
-        dds_wait_set, reinterpret_cast<dds_Condition *>(queue_guard_condition));
-      CHECK_ATTACH(ret);
+      rmw_ret_t rmw_ret_code = __attach_condition(
+        wait_set_info, reinterpret_cast<dds_Condition *>(queue_guard_condition));
+      if (rmw_ret_code != RMW_RET_OK) {
+        return rmw_ret_code;
+      }
     }
   }
 
+  return __detach_unused_conditions(wait_set_info);
+}
+
+// Blocks until an attached condition triggers, and collects the triggered
+// ones into the active set. Returns RMW_RET_TIMEOUT if none did in time.
+rmw_ret_t
+__wait_for_conditions(GurumddsWaitSetInfo * wait_set_info, const rmw_time_t * wait_timeout)
+{
+  dds_WaitSet * dds_wait_set = wait_set_info->wait_set;
+  dds_ConditionSeq * active_conditions = wait_set_info->active_conditions;
   rmw_ret_t rret = RMW_RET_OK;
 
   const char * env_name = "RMW_GURUMDDS_WAIT_USE_POLLING";
@@ -401,6 +466,77 @@ shared__rmw_wait(
     }
   }
 
+  // Entities look up their condition instead of scanning every active one
+  wait_set_info->active.clear();
+  for (uint32_t i = 0; i < dds_ConditionSeq_length(active_conditions); ++i) {
+    wait_set_info->active.insert(dds_ConditionSeq_get(active_conditions, i));
+  }
+
+  return rret;
+}
+
+template<typename SubscriberInfo, typename ServiceInfo, typename ClientInfo>
+rmw_ret_t
+shared__rmw_wait(
+  const char * implementation_identifier,
+  rmw_subscriptions_t * subscriptions,
+  rmw_guard_conditions_t * guard_conditions,
+  rmw_services_t * services,
+  rmw_clients_t * clients,
+  rmw_events_t * events,
+  rmw_wait_set_t * wait_set,
+  const rmw_time_t * wait_timeout)
+{
+  if (wait_set == nullptr) {
+    RMW_SET_ERROR_MSG("wait set handle is null");
+    return RMW_RET_ERROR;
+  }
+  RMW_CHECK_TYPE_IDENTIFIERS_MATCH(
+    wait set handle, wait_set->implementation_identifier,
+    implementation_identifier, return RMW_RET_ERROR);
+
+  GurumddsWaitSetInfo * wait_set_info = static_cast<GurumddsWaitSetInfo *>(wait_set->data);
+  if (wait_set_info == nullptr) {
+    RMW_SET_ERROR_MSG("WaitSet implementation struct is null");
+    return RMW_RET_ERROR;
+  }
+
+  dds_WaitSet * dds_wait_set = static_cast<dds_WaitSet *>(wait_set_info->wait_set);
+  if (dds_wait_set == nullptr) {
+    RMW_SET_ERROR_MSG("DDS wait set handle is null");
+    return RMW_RET_ERROR;
+  }
+
+  dds_ConditionSeq * active_conditions =
+    static_cast<dds_ConditionSeq *>(wait_set_info->active_conditions);
+  if (active_conditions == nullptr) {
+    RMW_SET_ERROR_MSG("DDS condition sequence handle is null");
+    return RMW_RET_ERROR;
+  }
+
+  // One lock covers the readiness scan and the attachments, so conditions
+  // can't be forgotten halfway through
+  std::unique_lock<std::mutex> lock(wait_set_info->mutex);
+  rmw_ret_t rret = RMW_RET_OK;
+
+  // Under sustained load something is usually ready already, and then the
+  // wait set is not needed at all
+  if (!__collect_triggered_conditions<SubscriberInfo, ServiceInfo, ClientInfo>(
+      wait_set_info, subscriptions, guard_conditions, services, clients))
+  {
+    rmw_ret_t ret_code = __attach_conditions<SubscriberInfo, ServiceInfo, ClientInfo>(
+      wait_set_info, subscriptions, guard_conditions, services, clients, events);
+    if (ret_code != RMW_RET_OK) {
+      return ret_code;
+    }
+    lock.unlock();
+
+    rret = __wait_for_conditions(wait_set_info, wait_timeout);
+    if (rret != RMW_RET_OK && rret != RMW_RET_TIMEOUT) {
+      return rret;
+    }
+  }
+
   if (subscriptions != nullptr) {
     for (size_t i = 0; i < subscriptions->subscriber_count; ++i) {
       SubscriberInfo * subscriber_info =
@@ -410,31 +546,15 @@ shared__rmw_wait(
         return RMW_RET_ERROR;
       }
 
-      dds_GuardCondition * queue_guard_condition = subscriber_info->queue_guard_condition;
-      if (!queue_guard_condition) {
+      dds_Condition * condition = __get_subscriber_condition(subscriber_info);
+      if (!condition) {
         RMW_SET_ERROR_MSG("read condition handle is null");
         return RMW_RET_ERROR;
       }
 
-      uint32_t j = 0;
-      for (; j < dds_ConditionSeq_length(active_conditions); ++j) {
-        if (
-          dds_ConditionSeq_get(active_conditions, j) ==
-          reinterpret_cast<dds_Condition *>(queue_guard_condition))
-        {
-          break;
-        }
-      }
-
-      if (j >= dds_ConditionSeq_length(active_conditions)) {
+      if (wait_set_info->active.count(condition) == 0) {
         subscriptions->subscribers[i] = 0;
       }
-
-      rmw_ret_t rmw_ret_code = __detach_condition(
-        dds_wait_set, reinterpret_cast<dds_Condition *>(queue_guard_condition));
-      if (rmw_ret_code != RMW_RET_OK) {
-        return rmw_ret_code;
-      }
     }
   }
 
@@ -447,26 +567,16 @@ shared__rmw_wait(
         return RMW_RET_ERROR;
       }
 
-      uint32_t j = 0;
-      for (; j < dds_ConditionSeq_length(active_conditions); ++j) {
-        if (dds_ConditionSeq_get(active_conditions, j) == condition) {
-          dds_GuardCondition * guard = reinterpret_cast<dds_GuardCondition *>(condition);
-          dds_ReturnCode_t ret = dds_GuardCondition_set_trigger_value(guard, false);
-          if (ret != dds_RETCODE_OK) {
-            RMW_SET_ERROR_MSG("failed to set trigger value");
-            return RMW_RET_ERROR;
-          }
-          break;
-        }
-      }
-
-      if (j >= dds_ConditionSeq_length(active_conditions)) {
+      if (wait_set_info->active.count(condition) == 0) {
         guard_conditions->guard_conditions[i] = 0;
+        continue;
       }
 
-      rmw_ret_t rmw_ret_code = __detach_condition(dds_wait_set, condition);
-      if (rmw_ret_code != RMW_RET_OK) {
-        return rmw_ret_code;
+      dds_GuardCondition * guard = reinterpret_cast<dds_GuardCondition *>(condition);
+      dds_ReturnCode_t ret = dds_GuardCondition_set_trigger_value(guard, false);
+      if (ret != dds_RETCODE_OK) {
+        RMW_SET_ERROR_MSG("failed to set trigger value");
+        return RMW_RET_ERROR;
       }
     }
   }
@@ -485,25 +595,11 @@ shared__rmw_wait(
         return RMW_RET_ERROR;
       }
 
-      uint32_t j = 0;
-      for (; j < dds_ConditionSeq_length(active_conditions); ++j) {
-        if (
-          dds_ConditionSeq_get(active_conditions, j) ==
-          reinterpret_cast<dds_Condition *>(queue_guard_condition))
-        {
-          break;
-        }
-      }
-
-      if (j >= dds_ConditionSeq_length(active_conditions)) {
+      if (wait_set_info->active.count(
+          reinterpret_cast<dds_Condition *>(queue_guard_condition)) == 0)
+      {
         services->services[i] = 0;
       }
-
-      rmw_ret_t rmw_ret_code = __detach_condition(
-        dds_wait_set, reinterpret_cast<dds_Condition *>(queue_guard_condition));
-      if (rmw_ret_code != RMW_RET_OK) {
-        return rmw_ret_code;
-      }
     }
   }
 
@@ -521,25 +617,11 @@ shared__rmw_wait(
         return RMW_RET_ERROR;
       }
 
-      uint32_t j = 0;
-      for (; j < dds_ConditionSeq_length(active_conditions); ++j) {
-        if (
-          dds_ConditionSeq_get(active_conditions, j) ==
-          reinterpret_cast<dds_Condition *>(queue_guard_condition))
-        {
-          break;
-        }
-      }
-
-      if (j >= dds_ConditionSeq_length(active_conditions)) {
+      if (wait_set_info->active.count(
+          reinterpret_cast<dds_Condition *>(queue_guard_condition)) == 0)
+      {
         clients->clients[i] = 0;
       }
-
-      rmw_ret_t rmw_ret_code = __detach_condition(
-        dds_wait_set, reinterpret_cast<dds_Condition *>(queue_guard_condition));
-      if (rmw_ret_code != RMW_RET_OK) {
-        return rmw_ret_code;
-      }
     }
   }
 
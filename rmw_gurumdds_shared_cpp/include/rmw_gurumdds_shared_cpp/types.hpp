@@ -27,13 +27,19 @@
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
 #include <utility>
 
+#include "rmw/event_callback_type.h"
 #include "rmw/rmw.h"
 #include "rmw/ret_types.h"
 
+#include "rcutils/time.h"
+
 #include "rmw_gurumdds_shared_cpp/dds_include.hpp"
 #include "rmw_gurumdds_shared_cpp/guid.hpp"
+#include "rmw_gurumdds_shared_cpp/message_queue.hpp"
 #include "rmw_gurumdds_shared_cpp/qos.hpp"
 #include "rmw_gurumdds_shared_cpp/rmw_common.hpp"
 #include "rmw_gurumdds_shared_cpp/topic_cache.hpp"
@@ -47,15 +53,220 @@ typedef struct _ListenerContext
   TopicCache<GuidPrefix_t> * topic_cache;
   rmw_guard_condition_t * graph_guard_condition;
   const char * implementation_identifier;
+  // Reused by every callback, guarded by mutex_
+  dds_DataSeq * samples;
+  dds_SampleInfoSeq * infos;
 } ListenerContext;
 
+// Takes back ROS messages deserialized ahead of a take that never used them
+class GurumddsMessageOwner
+{
+public:
+  virtual ~GurumddsMessageOwner() = default;
+  virtual void release_message(void * ros_message) = 0;
+};
+
 typedef struct _GurumddsMessage
 {
   void * sample;
   dds_SampleInfo * info;
   dds_UnsignedLong size;
+  // SampleInfo has no reception time, so samples are stamped when they are taken off the reader
+  rcutils_time_point_value_t received_timestamp;
+  // Numbers the samples accepted by a reader in the order they were taken, starting from 1
+  uint64_t reception_sequence_number;
+  // Set when the sample was deserialized on arrival, the sample is kept for serialized takes
+  void * ros_message;
+  GurumddsMessageOwner * ros_message_owner;
 } GurumddsMessage;
 
+typedef MessageQueue<GurumddsMessage> GurumddsMessageQueue;
+
+static inline void message_queue_free(GurumddsMessage & msg)
+{
+  if (msg.sample != nullptr) {
+    dds_free(msg.sample);
+  }
+  if (msg.info != nullptr) {
+    dds_free(msg.info);
+  }
+  if (msg.ros_message != nullptr) {
+    msg.ros_message_owner->release_message(msg.ros_message);
+  }
+}
+
+// Queues a message taken by the listener. When the queue is full the oldest
+// message is dropped, like KEEP_LAST history. Returns the number of dropped messages.
+static inline size_t message_queue_push(GurumddsMessageQueue & queue, const GurumddsMessage & msg)
+{
+  size_t dropped = 0;
+  GurumddsMessage oldest;
+  while (!queue.push(msg)) {
+    if (queue.pop(oldest)) {
+      message_queue_free(oldest);
+      dropped++;
+    }
+  }
+  return dropped;
+}
+
+// Called after pushing; the pushes must be visible to whoever observes the trigger
+static inline void message_queue_notify(dds_GuardCondition * guard_condition)
+{
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  dds_GuardCondition_set_trigger_value(guard_condition, true);
+}
+
+// Takes the oldest queued message. The guard condition is reset when the
+// queue drains; the re-check covers a push that raced with the reset, so a
+// queued message is never left behind an untriggered guard condition.
+static inline bool message_queue_pop(
+  GurumddsMessageQueue & queue, dds_GuardCondition * guard_condition, GurumddsMessage & msg)
+{
+  if (!queue.pop(msg)) {
+    return false;
+  }
+
+  if (queue.empty()) {
+    dds_GuardCondition_set_trigger_value(guard_condition, false);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!queue.empty()) {
+      dds_GuardCondition_set_trigger_value(guard_condition, true);
+    }
+  }
+
+  return true;
+}
+
+static inline void message_queue_clear(GurumddsMessageQueue & queue)
+{
+  GurumddsMessage msg;
+  while (queue.pop(msg)) {
+    message_queue_free(msg);
+  }
+}
+
+// Callback set by event-driven executors. Events that occur while no callback
+// is set are counted and reported as soon as one is set.
+struct GurumddsEventCallback
+{
+  GurumddsEventCallback()
+  : callback(nullptr), user_data(nullptr), unread_count(0)
+  {}
+
+  // Returns true if events that occurred without a callback were reported to the new one
+  bool set(rmw_event_callback_t new_callback, const void * new_user_data)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    bool replayed = false;
+    if (new_callback != nullptr && unread_count > 0) {
+      new_callback(new_user_data, unread_count);
+      unread_count = 0;
+      replayed = true;
+    }
+    callback = new_callback;
+    user_data = new_callback != nullptr ? new_user_data : nullptr;
+    return replayed;
+  }
+
+  bool is_set()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    return callback != nullptr;
+  }
+
+  void notify(size_t count)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (callback != nullptr) {
+      callback(user_data, count);
+    } else {
+      unread_count += count;
+    }
+  }
+
+  std::mutex mutex;
+  rmw_event_callback_t callback;
+  const void * user_data;
+  size_t unread_count;
+};
+
+// Samples taken by one listener callback unless configured per reader
+static const uint32_t GURUMDDS_READER_MAX_SAMPLES = 64;
+
+// Sample, info and size sequences kept per reader so that listener callbacks
+// do not allocate them on every invocation. The sequences are created by the
+// first callback and only have their length reset afterwards.
+struct GurumddsReaderSeqs
+{
+  GurumddsReaderSeqs()
+  : samples(nullptr), infos(nullptr), sizes(nullptr), max_samples(GURUMDDS_READER_MAX_SAMPLES),
+    reception_count(0)
+  {}
+
+  ~GurumddsReaderSeqs()
+  {
+    if (samples != nullptr) {
+      dds_DataSeq_delete(samples);
+    }
+    if (infos != nullptr) {
+      dds_SampleInfoSeq_delete(infos);
+    }
+    if (sizes != nullptr) {
+      dds_UnsignedLongSeq_delete(sizes);
+    }
+  }
+
+  GurumddsReaderSeqs(const GurumddsReaderSeqs &) = delete;
+  GurumddsReaderSeqs & operator=(const GurumddsReaderSeqs &) = delete;
+
+  // Must be called with mutex held
+  bool prepare()
+  {
+    if (samples == nullptr) {
+      samples = dds_DataSeq_create(max_samples);
+      if (samples == nullptr) {
+        return false;
+      }
+    }
+    if (infos == nullptr) {
+      infos = dds_SampleInfoSeq_create(max_samples);
+      if (infos == nullptr) {
+        return false;
+      }
+    }
+    if (sizes == nullptr) {
+      sizes = dds_UnsignedLongSeq_create(max_samples);
+      if (sizes == nullptr) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Drops the taken elements without freeing them; their ownership has moved on
+  void reset()
+  {
+    for (uint32_t i = dds_DataSeq_length(samples); i > 0; i--) {
+      dds_DataSeq_remove(samples, i - 1);
+    }
+    for (uint32_t i = dds_SampleInfoSeq_length(infos); i > 0; i--) {
+      dds_SampleInfoSeq_remove(infos, i - 1);
+    }
+    for (uint32_t i = dds_UnsignedLongSeq_length(sizes); i > 0; i--) {
+      dds_UnsignedLongSeq_remove(sizes, i - 1);
+    }
+  }
+
+  std::mutex mutex;
+  dds_DataSeq * samples;
+  dds_SampleInfoSeq * infos;
+  dds_UnsignedLongSeq * sizes;
+  uint32_t max_samples;
+  // Last reception sequence number handed out for this reader
+  std::atomic<uint64_t> reception_count;
+};
+
 static void pub_on_data_available(const dds_DataReader * a_reader)
 {
   dds_DataReader * reader = const_cast<dds_DataReader *>(a_reader);
@@ -66,32 +277,34 @@ static void pub_on_data_available(const dds_DataReader * a_reader)
   }
 
   std::lock_guard<std::mutex> lock(*context->mutex_);
-  dds_DataSeq * samples = dds_DataSeq_create(8);
-  if (samples == nullptr) {
-    fprintf(stderr, "failed to create data sample sequence\n");
-    return;
+  if (context->samples == nullptr) {
+    context->samples = dds_DataSeq_create(8);
+    if (context->samples == nullptr) {
+      fprintf(stderr, "failed to create data sample sequence\n");
+      return;
+    }
   }
-  dds_SampleInfoSeq * infos = dds_SampleInfoSeq_create(8);
-  if (infos == nullptr) {
-    dds_DataSeq_delete(samples);
-    fprintf(stderr, "failed to create sample info sequence\n");
-    return;
+  if (context->infos == nullptr) {
+    context->infos = dds_SampleInfoSeq_create(8);
+    if (context->infos == nullptr) {
+      fprintf(stderr, "failed to create sample info sequence\n");
+      return;
+    }
   }
+  // return_loan() empties the sequences again
+  dds_DataSeq * samples = context->samples;
+  dds_SampleInfoSeq * infos = context->infos;
 
   dds_ReturnCode_t ret = dds_DataReader_take(
     reader, samples, infos, dds_LENGTH_UNLIMITED,
     dds_ANY_SAMPLE_STATE, dds_ANY_VIEW_STATE, dds_ANY_INSTANCE_STATE);
   if (ret == dds_RETCODE_NO_DATA) {
     dds_DataReader_return_loan(reader, samples, infos);
-    dds_DataSeq_delete(samples);
-    dds_SampleInfoSeq_delete(infos);
     return;
   }
   if (ret != dds_RETCODE_OK) {
     fprintf(stderr, "failed to access data from the built-in reader\n");
     dds_DataReader_return_loan(reader, samples, infos);
-    dds_DataSeq_delete(samples);
-    dds_SampleInfoSeq_delete(infos);
     return;
   }
 
@@ -136,9 +349,6 @@ static void pub_on_data_available(const dds_DataReader * a_reader)
 
   dds_DataReader_return_loan(reader, samples, infos);
 
-  dds_DataSeq_delete(samples);
-  dds_SampleInfoSeq_delete(infos);
-
   dds_DataReader_set_listener_context(reader, context);
 }
 
@@ -152,32 +362,34 @@ static void sub_on_data_available(const dds_DataReader * a_reader)
   }
 
   std::lock_guard<std::mutex> lock(*context->mutex_);
-  dds_DataSeq * samples = dds_DataSeq_create(8);
-  if (samples == nullptr) {
-    fprintf(stderr, "failed to create data sample sequence\n");
-    return;
+  if (context->samples == nullptr) {
+    context->samples = dds_DataSeq_create(8);
+    if (context->samples == nullptr) {
+      fprintf(stderr, "failed to create data sample sequence\n");
+      return;
+    }
   }
-  dds_SampleInfoSeq * infos = dds_SampleInfoSeq_create(8);
-  if (infos == nullptr) {
-    dds_DataSeq_delete(samples);
-    fprintf(stderr, "failed to create sample info sequence\n");
-    return;
+  if (context->infos == nullptr) {
+    context->infos = dds_SampleInfoSeq_create(8);
+    if (context->infos == nullptr) {
+      fprintf(stderr, "failed to create sample info sequence\n");
+      return;
+    }
   }
+  // return_loan() empties the sequences again
+  dds_DataSeq * samples = context->samples;
+  dds_SampleInfoSeq * infos = context->infos;
 
   dds_ReturnCode_t ret = dds_DataReader_take(
     reader, samples, infos, dds_LENGTH_UNLIMITED,
     dds_ANY_SAMPLE_STATE, dds_ANY_VIEW_STATE, dds_ANY_INSTANCE_STATE);
   if (ret == dds_RETCODE_NO_DATA) {
     dds_DataReader_return_loan(reader, samples, infos);
-    dds_DataSeq_delete(samples);
-    dds_SampleInfoSeq_delete(infos);
     return;
   }
   if (ret != dds_RETCODE_OK) {
     fprintf(stderr, "failed to access data from the built-in reader\n");
     dds_DataReader_return_loan(reader, samples, infos);
-    dds_DataSeq_delete(samples);
-    dds_SampleInfoSeq_delete(infos);
     return;
   }
 
@@ -222,16 +434,40 @@ static void sub_on_data_available(const dds_DataReader * a_reader)
 
   dds_DataReader_return_loan(reader, samples, infos);
 
-  dds_DataSeq_delete(samples);
-  dds_SampleInfoSeq_delete(infos);
-
   dds_DataReader_set_listener_context(reader, context);
 }
 
+// Overloaded for entities that may discard samples before they are queued
+template<typename SubscriberInfo>
+static inline bool reader_accept_sample(
+  SubscriberInfo * subscriber_info, const GurumddsMessage & msg)
+{
+  (void)subscriber_info;
+  (void)msg;
+  return true;
+}
+
+// Overloaded for entities that report messages dropped from a full message queue
+template<typename SubscriberInfo>
+static inline void reader_on_messages_dropped(SubscriberInfo * subscriber_info, size_t count)
+{
+  (void)subscriber_info;
+  (void)count;
+}
+
+// Overloaded for entities that keep accepted samples elsewhere than their message queue.
+// Returns whether the message was queued, and adds the messages lost to dropped.
+template<typename SubscriberInfo>
+static inline bool reader_queue_message(
+  SubscriberInfo * subscriber_info, const GurumddsMessage & msg, size_t * dropped)
+{
+  *dropped += message_queue_push(subscriber_info->message_queue, msg);
+  return true;
+}
+
 template<typename SubscriberInfo>
 static void reader_on_data_available(const dds_DataReader * a_reader)
 {
-  const uint32_t MAX_SAMPLES = 64;
   dds_DataReader * reader = const_cast<dds_DataReader *>(a_reader);
   SubscriberInfo * subscriber_info =
     reinterpret_cast<SubscriberInfo *>(dds_DataReader_get_listener_context(reader));
@@ -240,53 +476,66 @@ static void reader_on_data_available(const dds_DataReader * a_reader)
     return;
   }
 
-  dds_DataSeq * sample_seq = dds_DataSeq_create(MAX_SAMPLES);
-  if (sample_seq == nullptr) {
-    return;
-  }
-
-  dds_SampleInfoSeq * info_seq = dds_SampleInfoSeq_create(MAX_SAMPLES);
-  if (info_seq == nullptr) {
-    dds_DataSeq_delete(sample_seq);
-    return;
-  }
-
-  dds_UnsignedLongSeq * size_seq = dds_UnsignedLongSeq_create(MAX_SAMPLES);
-  if (size_seq == nullptr) {
-    dds_DataSeq_delete(sample_seq);
-    dds_SampleInfoSeq_delete(info_seq);
+  GurumddsReaderSeqs & seqs = subscriber_info->reader_seqs;
+  std::lock_guard<std::mutex> lock(seqs.mutex);
+  if (!seqs.prepare()) {
+    RCUTILS_LOG_ERROR_NAMED("rmw_gurumdds_cpp", "Failed to take data: out of memory");
     return;
   }
 
   dds_ReturnCode_t ret = dds_DataReader_raw_take(
-    reader, dds_HANDLE_NIL, sample_seq, info_seq, size_seq, MAX_SAMPLES,
+    reader, dds_HANDLE_NIL, seqs.samples, seqs.infos, seqs.sizes, seqs.max_samples,
     dds_ANY_SAMPLE_STATE, dds_ANY_VIEW_STATE, dds_ANY_INSTANCE_STATE);
   if (ret != dds_RETCODE_OK) {
     if (ret != dds_RETCODE_NO_DATA) {
       RCUTILS_LOG_ERROR_NAMED("rmw_gurumdds_cpp", "Failed to take data");
     }
-    dds_DataSeq_delete(sample_seq);
-    dds_SampleInfoSeq_delete(info_seq);
-    dds_UnsignedLongSeq_delete(size_seq);
+    seqs.reset();
     return;
   }
 
-  subscriber_info->queue_mutex.lock();
-  dds_GuardCondition_set_trigger_value(subscriber_info->queue_guard_condition, true);
-  for (uint32_t i = 0; i < dds_DataSeq_length(sample_seq); i++) {
+  size_t queued = 0;
+  size_t dropped = 0;
+  size_t evicted = 0;
+  rcutils_time_point_value_t received_timestamp = 0;
+  rcutils_system_time_now(&received_timestamp);
+  for (uint32_t i = 0; i < dds_DataSeq_length(seqs.samples); i++) {
     GurumddsMessage msg;
-    msg.sample = dds_DataSeq_get(sample_seq, i);
-    msg.info = dds_SampleInfoSeq_get(info_seq, i);
-    msg.size = dds_UnsignedLongSeq_get(size_seq, i);
-    subscriber_info->message_queue.push(std::move(msg));
-  }
-  subscriber_info->queue_mutex.unlock();
-
-  // return loan manually after deserialization
-  // or before destruction of the queue using free()
-  dds_DataSeq_delete(sample_seq);
-  dds_SampleInfoSeq_delete(info_seq);
-  dds_UnsignedLongSeq_delete(size_seq);
+    msg.sample = dds_DataSeq_get(seqs.samples, i);
+    msg.info = dds_SampleInfoSeq_get(seqs.infos, i);
+    msg.size = dds_UnsignedLongSeq_get(seqs.sizes, i);
+    msg.received_timestamp = received_timestamp;
+    msg.ros_message = nullptr;
+    msg.ros_message_owner = nullptr;
+    if (!reader_accept_sample(subscriber_info, msg)) {
+      message_queue_free(msg);
+      continue;
+    }
+    msg.reception_sequence_number = ++seqs.reception_count;
+    size_t msg_dropped = 0;
+    if (reader_queue_message(subscriber_info, msg, &msg_dropped)) {
+      queued++;
+      evicted += msg_dropped;
+    }
+    dropped += msg_dropped;
+  }
+
+  // The queue owns the samples now, they are freed after deserialization
+  // or before destruction of the queue
+  seqs.reset();
+
+  if (dropped > 0) {
+    reader_on_messages_dropped(subscriber_info, dropped);
+  }
+
+  if (queued > 0) {
+    message_queue_notify(subscriber_info->queue_guard_condition);
+  }
+
+  // Evicted messages made room for new ones, so only the rest adds to what can be taken
+  if (queued > evicted) {
+    subscriber_info->new_message_callback.notify(queued - evicted);
+  }
 }
 
 class GurumddsDataReaderListener
@@ -296,9 +545,20 @@ public:
     const char * implementation_identifier, rmw_guard_condition_t * graph_guard_condition)
   : graph_guard_condition(graph_guard_condition),
     implementation_identifier(implementation_identifier)
-  {}
+  {
+    context.samples = nullptr;
+    context.infos = nullptr;
+  }
 
-  virtual ~GurumddsDataReaderListener() = default;
+  virtual ~GurumddsDataReaderListener()
+  {
+    if (context.samples != nullptr) {
+      dds_DataSeq_delete(context.samples);
+    }
+    if (context.infos != nullptr) {
+      dds_SampleInfoSeq_delete(context.infos);
+    }
+  }
 
   RMW_GURUMDDS_SHARED_CPP_PUBLIC
   virtual void add_information(
@@ -397,6 +657,13 @@ typedef struct _GurumddsWaitSetInfo
   dds_WaitSet * wait_set;
   dds_ConditionSeq * active_conditions;
   dds_ConditionSeq * attached_conditions;
+  // Conditions stay attached between waits, each with the last wait that used it.
+  // Guarded by mutex, since deleted conditions are detached from other threads.
+  std::mutex mutex;
+  std::unordered_map<dds_Condition *, uint64_t> attached;
+  uint64_t wait_count;
+  // Conditions returned by the last wait, only used by the waiting thread
+  std::unordered_set<dds_Condition *> active;
 } GurumddsWaitSetInfo;
 
 typedef struct _GurumddsEventInfo
@@ -405,6 +672,12 @@ typedef struct _GurumddsEventInfo
   virtual rmw_ret_t get_status(const dds_StatusMask mask, void * event) = 0;
   virtual dds_StatusCondition * get_statuscondition() = 0;
   virtual dds_StatusMask get_status_changes() = 0;
+  // Stores the callback and installs the DDS listener for the event's status
+  virtual rmw_ret_t set_event_callback(
+    rmw_event_type_t event_type, rmw_event_callback_t callback, const void * user_data) = 0;
+
+  // Set through rmw_event_set_callback(), indexed by event type
+  GurumddsEventCallback event_callbacks[RMW_EVENT_INVALID];
 } GurumddsEventInfo;
 
 #endif  // RMW_GURUMDDS_SHARED_CPP__TYPES_HPP_
@@ -170,6 +170,25 @@ bool get_datareader_qos(
   return true;
 }
 
+size_t
+get_message_queue_capacity(const dds_DataReaderQos * datareader_qos)
+{
+  // Samples are taken from the reader as they arrive, so the message queue
+  // holds the reader history on behalf of the DDS entity
+  if (datareader_qos->history.kind == dds_KEEP_LAST_HISTORY_QOS) {
+    if (datareader_qos->history.depth > 0) {
+      return static_cast<size_t>(datareader_qos->history.depth);
+    }
+    return 1;
+  }
+
+  if (datareader_qos->resource_limits.max_samples > 0) {
+    return static_cast<size_t>(datareader_qos->resource_limits.max_samples);
+  }
+
+  return 4096;
+}
+
 enum rmw_qos_reliability_policy_t
 convert_reliability(
   dds_ReliabilityQosPolicy policy)
@@ -75,3 +75,32 @@ shared__rmw_take_event(
   *taken = (ret_code == RMW_RET_OK);
   return ret_code;
 }
+
+rmw_ret_t
+shared__rmw_event_set_callback(
+  const char * implementation_identifier,
+  rmw_event_t * event_handle,
+  rmw_event_callback_t callback,
+  const void * user_data)
+{
+  RMW_CHECK_ARGUMENT_FOR_NULL(event_handle, RMW_RET_INVALID_ARGUMENT);
+
+  RMW_CHECK_TYPE_IDENTIFIERS_MATCH(
+    event handle,
+    event_handle->implementation_identifier,
+    implementation_identifier,
+    return RMW_RET_INCORRECT_RMW_IMPLEMENTATION);
+
+  if (!is_event_supported(event_handle->event_type)) {
+    RMW_SET_ERROR_MSG_WITH_FORMAT_STRING("event %d not supported", event_handle->event_type);
+    return RMW_RET_UNSUPPORTED;
+  }
+
+  auto custom_event_info = static_cast<GurumddsEventInfo *>(event_handle->data);
+  if (custom_event_info == nullptr) {
+    RMW_SET_ERROR_MSG("event handle is null");
+    return RMW_RET_ERROR;
+  }
+
+  return custom_event_info->set_event_callback(event_handle->event_type, callback, user_data);
+}
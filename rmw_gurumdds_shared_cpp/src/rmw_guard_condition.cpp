@@ -63,6 +63,7 @@ shared__rmw_destroy_guard_condition(
 
   dds_GuardCondition * dds_guard_condition =
     static_cast<dds_GuardCondition *>(guard_condition->data);
+  shared__rmw_wait_set_forget_condition(reinterpret_cast<dds_Condition *>(dds_guard_condition));
   dds_GuardCondition_delete(dds_guard_condition);
   rmw_guard_condition_free(guard_condition);
 
@@ -12,6 +12,11 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <limits>
+#include <mutex>
+#include <new>
+#include <unordered_set>
+
 #include "rmw/allocators.h"
 #include "rmw/error_handling.h"
 #include "rmw/rmw.h"
@@ -21,6 +26,31 @@
 #include "rmw_gurumdds_shared_cpp/types.hpp"
 #include "rmw_gurumdds_shared_cpp/dds_include.hpp"
 
+// Wait sets whose attached conditions are detached before the conditions are deleted
+struct WaitSetRegistry
+{
+  std::mutex mutex;
+  std::unordered_set<GurumddsWaitSetInfo *> wait_sets;
+};
+
+// Never destroyed, since wait sets may be destroyed during static destruction
+static WaitSetRegistry &
+_get_wait_set_registry()
+{
+  static WaitSetRegistry * registry = new WaitSetRegistry();
+  return *registry;
+}
+
+static void
+_detach_all_conditions(GurumddsWaitSetInfo * wait_set_info)
+{
+  std::lock_guard<std::mutex> lock(wait_set_info->mutex);
+  for (auto & pair : wait_set_info->attached) {
+    dds_WaitSet_detach_condition(wait_set_info->wait_set, pair.first);
+  }
+  wait_set_info->attached.clear();
+}
+
 rmw_wait_set_t *
 shared__rmw_create_wait_set(
   const char * implementation_identifier,
@@ -34,8 +64,13 @@ shared__rmw_create_wait_set(
     implementation_identifier,
     return nullptr);
 
-  (void)max_conditions;
   rmw_wait_set_t * wait_set = rmw_wait_set_allocate();
+  // Conditions are known up front when max_conditions is set, so waits don't grow the sequence
+  uint32_t capacity = 4;
+  if (max_conditions > capacity) {
+    capacity = max_conditions < std::numeric_limits<uint32_t>::max() ?
+      static_cast<uint32_t>(max_conditions) : std::numeric_limits<uint32_t>::max();
+  }
 
   GurumddsWaitSetInfo * wait_set_info = nullptr;
 
@@ -45,8 +80,8 @@ shared__rmw_create_wait_set(
   }
 
   wait_set->implementation_identifier = implementation_identifier;
-  wait_set->data = rmw_allocate(sizeof(GurumddsWaitSetInfo));
-  wait_set_info = static_cast<GurumddsWaitSetInfo *>(wait_set->data);
+  wait_set_info = new(std::nothrow) GurumddsWaitSetInfo();
+  wait_set->data = wait_set_info;
 
   if (!wait_set_info) {
     RMW_SET_ERROR_MSG("failed to allocate wait set");
@@ -59,7 +94,7 @@ shared__rmw_create_wait_set(
     goto fail;
   }
 
-  wait_set_info->active_conditions = dds_ConditionSeq_create(4);
+  wait_set_info->active_conditions = dds_ConditionSeq_create(capacity);
   if (wait_set_info->active_conditions == nullptr) {
     RMW_SET_ERROR_MSG("failed to allocate active_conditions sequence");
     goto fail;
@@ -71,6 +106,17 @@ shared__rmw_create_wait_set(
     goto fail;
   }
 
+  try {
+    wait_set_info->attached.reserve(max_conditions);
+    wait_set_info->active.reserve(max_conditions);
+    WaitSetRegistry & registry = _get_wait_set_registry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.wait_sets.insert(wait_set_info);
+  } catch (const std::bad_alloc &) {
+    RMW_SET_ERROR_MSG("failed to allocate wait set");
+    goto fail;
+  }
+
   return wait_set;
 
 fail:
@@ -87,14 +133,11 @@ fail:
       dds_WaitSet_delete(wait_set_info->wait_set);
     }
 
+    delete wait_set_info;
     wait_set_info = nullptr;
   }
 
   if (wait_set != nullptr) {
-    if (wait_set->data != nullptr) {
-      rmw_free(wait_set->data);
-    }
-
     rmw_wait_set_free(wait_set);
   }
 
@@ -115,6 +158,16 @@ shared__rmw_destroy_wait_set(const char * implementation_identifier, rmw_wait_se
 
   GurumddsWaitSetInfo * wait_set_info = static_cast<GurumddsWaitSetInfo *>(wait_set->data);
 
+  {
+    WaitSetRegistry & registry = _get_wait_set_registry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.wait_sets.erase(wait_set_info);
+  }
+
+  if (wait_set_info->wait_set != nullptr) {
+    _detach_all_conditions(wait_set_info);
+  }
+
   if (wait_set_info->active_conditions != nullptr) {
     dds_ConditionSeq_delete(wait_set_info->active_conditions);
   }
@@ -127,15 +180,29 @@ shared__rmw_destroy_wait_set(const char * implementation_identifier, rmw_wait_se
     dds_WaitSet_delete(wait_set_info->wait_set);
   }
 
+  delete wait_set_info;
   wait_set_info = nullptr;
 
-  if (wait_set->data != nullptr) {
-    rmw_free(wait_set->data);
-  }
-
   if (wait_set != nullptr) {
     rmw_wait_set_free(wait_set);
   }
 
   return RMW_RET_OK;
 }
+
+void
+shared__rmw_wait_set_forget_condition(dds_Condition * condition)
+{
+  if (condition == nullptr) {
+    return;
+  }
+
+  WaitSetRegistry & registry = _get_wait_set_registry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  for (GurumddsWaitSetInfo * wait_set_info : registry.wait_sets) {
+    std::lock_guard<std::mutex> info_lock(wait_set_info->mutex);
+    if (wait_set_info->attached.erase(condition) > 0) {
+      dds_WaitSet_detach_condition(wait_set_info->wait_set, condition);
+    }
+  }
+}